@@ -16,8 +16,24 @@ install_gtest() {
   )
 }
 
+install_benchmark() {
+  (
+    cd "$TDIR"
+
+    git clone https://github.com/google/benchmark.git
+    cd benchmark
+    mkdir build
+    cd build
+    cmake .. -DCMAKE_INSTALL_PREFIX="/opt" -DCMAKE_BUILD_TYPE=Release \
+      -DBENCHMARK_ENABLE_TESTING=OFF
+    make -j "$(getconf _NPROCESSORS_ONLN)"
+    make install
+  )
+}
+
 main() {
   install_gtest
+  install_benchmark
   rm -rf "$TDIR"
 }
 
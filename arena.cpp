@@ -0,0 +1,51 @@
+#include <cstring>
+
+#include "arena.h"
+
+std::string_view
+Arena::copy(std::string_view s) {
+  // Big strings get a block of their own rather than wasting the rest of the
+  // current one.
+  if (BLOCK / 4 < s.size()) {
+    auto &block = m_blocks.emplace_back(new char[s.size()]);
+    std::memcpy(block.get(), s.data(), s.size());
+    return {block.get(), s.size()};
+  }
+
+  if (m_left < s.size()) {
+    m_next = m_blocks.emplace_back(new char[BLOCK]).get();
+    m_left = BLOCK;
+  }
+
+  std::memcpy(m_next, s.data(), s.size());
+  const auto out = std::string_view{m_next, s.size()};
+  m_next += s.size();
+  m_left -= s.size();
+  return out;
+}
+
+std::string_view
+Arena::intern(std::string_view s) {
+  if (s.empty()) {
+    return {};
+  }
+
+  if (const auto it = m_strings.find(s); m_strings.end() != it) {
+    return *it;
+  }
+
+  const auto out = copy(s);
+  m_strings.insert(out);
+  m_bytes += out.size();
+  return out;
+}
+
+std::size_t
+Arena::size() const {
+  return m_strings.size();
+}
+
+std::size_t
+Arena::bytes() const {
+  return m_bytes;
+}
@@ -0,0 +1,39 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// Owns the strings resolution creates -- expanded actions, macro values -- for
+// as long as the Environment that refers to them. Strings are copied into
+// large blocks, and each distinct string is stored once, so interning one
+// that's already there costs a lookup and no allocation. Moving an Arena
+// leaves every view it handed out valid.
+class Arena {
+  static constexpr std::size_t BLOCK = 64 * 1024;
+
+  std::vector<std::unique_ptr<char[]>> m_blocks = {};
+  char *m_next = nullptr;
+  std::size_t m_left = 0;
+  std::size_t m_bytes = 0;
+  std::unordered_set<std::string_view> m_strings = {};
+
+  [[nodiscard]] std::string_view copy(std::string_view s);
+
+public:
+  Arena() = default;
+  Arena(Arena &&) = default;
+  Arena &operator=(Arena &&) = default;
+
+  // Returns a view of a copy of `s' that lives as long as the arena.
+  [[nodiscard]] std::string_view intern(std::string_view s);
+
+  // The number of distinct strings and the bytes they take.
+  [[nodiscard]] std::size_t size() const;
+  [[nodiscard]] std::size_t bytes() const;
+};
+
+#endif // ARENA_H
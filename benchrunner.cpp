@@ -0,0 +1,314 @@
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "build.h"
+#include "exec.h"
+#include "fab.h"
+#include "scan.h"
+#include "statcache.h"
+#include "statring.h"
+
+namespace {
+constexpr auto TRIVIAL = std::string_view{"true"};
+
+// Each iteration runs a batch of trivial actions, so the reported rate is
+// dominated by process creation rather than by the actions themselves.
+void
+BM_ActionsViaSystem(benchmark::State &state) {
+  const auto cmd = std::string{TRIVIAL};
+  for (auto _ : state) {
+    for (auto i = 0; i < state.range(0); ++i) {
+      benchmark::DoNotOptimize(system(cmd.c_str()));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void
+BM_ActionsViaShell(benchmark::State &state) {
+  for (auto _ : state) {
+    for (auto i = 0; i < state.range(0); ++i) {
+      benchmark::DoNotOptimize(spawn_shell(TRIVIAL));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void
+BM_ActionsViaSpawn(benchmark::State &state) {
+  for (auto _ : state) {
+    for (auto i = 0; i < state.range(0); ++i) {
+      benchmark::DoNotOptimize(run_command(TRIVIAL));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// A generated Fabfile of `rules' rules with long, path-like names -- the
+// shape the lexer spends its time on in practice.
+std::string
+generated_fabfile(std::int64_t rules) {
+  auto out = std::string{"# generated\n"};
+  for (auto i = 0; i < rules; ++i) {
+    const auto n = std::to_string(i);
+    out += "build/objects/module_" + n + "/source_file_" + n +
+           ".o <- src/module_" + n + "/source_file_" + n + ".c {\n" +
+           "  cc -O2 -Wall -c -o $@ $<;\n}\n";
+  }
+
+  return out;
+}
+
+// Finds every identifier end in the generated source with one instruction
+// set. Arg(0) is the scalar classifier; the others are the vector ones.
+void
+BM_ScanIdentifiers(benchmark::State &state) {
+  const auto source = generated_fabfile(10000);
+  const auto isa = static_cast<scan::Isa>(state.range(0));
+
+  if (scan::best_isa() < isa) {
+    state.SkipWithError("not supported on this CPU");
+    return;
+  }
+
+  for (auto _ : state) {
+    auto classes = scan::Classifier{source, isa};
+    for (auto at = std::size_t{0}; at < source.size(); ++at) {
+      at = classes.find(at, scan::Space | scan::Newline | scan::SemiColon);
+    }
+  }
+
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<std::int64_t>(source.size()));
+}
+
+// A generated project of `objects' compile rules that use macros, linked
+// into a library per hundred objects, under an `all' rule -- the shape of the
+// Fabfiles the whole pipeline sees at scale. Returns the text and the number
+// of rules in it.
+std::pair<std::string, std::int64_t>
+generated_project(std::int64_t objects) {
+  constexpr auto PER_LIB = std::int64_t{100};
+  const auto libs = (objects + PER_LIB - 1) / PER_LIB;
+  const auto lib = [](std::int64_t l) {
+    return "lib/lib_" + std::to_string(l) + ".a";
+  };
+
+  auto out = std::string{"CC := cc;\nCFLAGS := -O2 -Wall;\n\nall <-"};
+  for (auto l = std::int64_t{0}; l < libs; ++l) {
+    out += " " + lib(l);
+  }
+  out += ";\n";
+
+  for (auto l = std::int64_t{0}; l < libs; ++l) {
+    out += lib(l) + " <-";
+    for (auto i = l * PER_LIB; i < std::min(objects, (l + 1) * PER_LIB); ++i) {
+      out += " build/module_" + std::to_string(i) + ".o";
+    }
+    out += " {\n  ar rcs $@ $<;\n}\n";
+  }
+
+  for (auto i = std::int64_t{0}; i < objects; ++i) {
+    const auto n = std::to_string(i);
+    out += "build/module_" + n + ".o <- src/module_" + n + ".c {\n" +
+           "  $(CC) $(CFLAGS) -c -o $@ $<;\n}\n";
+  }
+
+  return {std::move(out), 1 + libs + objects};
+}
+
+// Arg(0) throughout is the number of compile rules in the generated project.
+void
+BM_Lex(benchmark::State &state) {
+  const auto source = generated_project(state.range(0)).first;
+  auto tokens = std::int64_t{0};
+
+  for (auto _ : state) {
+    auto lexer = Lexer{source};
+    while (Token::Ty::Eof != lexer.next().ty()) {
+      ++tokens;
+    }
+  }
+
+  state.SetItemsProcessed(tokens);
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<std::int64_t>(source.size()));
+}
+
+// Parses and resolves tokens that were lexed beforehand.
+void
+BM_Parse(benchmark::State &state) {
+  const auto [source, rules] = generated_project(state.range(0));
+  const auto tokens = TokenStream{source};
+
+  for (auto _ : state) {
+    const auto env = parse(tokens);
+    benchmark::DoNotOptimize(env.rules.size());
+  }
+
+  state.SetItemsProcessed(state.iterations() * rules);
+}
+
+// The whole pipeline from source text to a resolved Environment.
+void
+BM_LexParseResolve(benchmark::State &state) {
+  const auto [source, rules] = generated_project(state.range(0));
+
+  for (auto _ : state) {
+    const auto env = parse(Lexer{source});
+    benchmark::DoNotOptimize(env.rules.size());
+  }
+
+  state.SetItemsProcessed(state.iterations() * rules);
+}
+
+void
+BM_Get(benchmark::State &state) {
+  const auto source = generated_project(state.range(0)).first;
+  const auto env = parse(Lexer{source});
+
+  for (auto _ : state) {
+    for (const auto &rule : env.rules) {
+      benchmark::DoNotOptimize(&env.get(rule.target));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() *
+                          static_cast<std::int64_t>(env.rules.size()));
+}
+
+// Plans and checks every rule without running anything. None of the files
+// exist, so every rule is out of date and has its actions printed -- into a
+// discarded buffer.
+void
+BM_DryRun(benchmark::State &state) {
+  const auto [source, rules] = generated_project(state.range(0));
+  const auto env = parse(Lexer{source});
+  const auto options = BuildOptions{.dry_run = true};
+
+  auto sink = std::ostringstream{};
+  auto *const stdout_buf = std::cout.rdbuf(sink.rdbuf());
+
+  for (auto _ : state) {
+    auto cache = StatCache{};
+    build(env, env.head, options, cache);
+    sink.str({});
+  }
+
+  std::cout.rdbuf(stdout_buf);
+  state.SetItemsProcessed(state.iterations() * rules);
+}
+
+// `n' empty files in a directory of their own, made once per size and kept
+// until the run ends.
+[[nodiscard]] const std::vector<std::string> &
+stat_targets(std::int64_t n) {
+  static auto made = std::map<std::int64_t, std::vector<std::string>>{};
+
+  auto &paths = made[n];
+  if (paths.empty()) {
+    const auto dir = std::filesystem::temp_directory_path() /
+                     ("fab_bench_stat_" + std::to_string(n));
+    std::filesystem::create_directories(dir);
+
+    for (std::int64_t i = 0; i < n; ++i) {
+      paths.push_back((dir / ("f_" + std::to_string(i))).string());
+      std::ofstream{paths.back()};
+    }
+  }
+
+  return paths;
+}
+
+// One `stat' per path, one after another, as the walk does without a
+// prefetch.
+void
+BM_StatEachPath(benchmark::State &state) {
+  const auto &paths = stat_targets(state.range(0));
+
+  for (auto _ : state) {
+    for (const auto &p : paths) {
+      benchmark::DoNotOptimize(stat_file(p));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() *
+                          static_cast<std::int64_t>(paths.size()));
+}
+
+// The same paths as `statx' requests batched through an io_uring. The kernel
+// does the work on threads of its own, so only real time compares fairly.
+void
+BM_StatRing(benchmark::State &state) {
+  const auto &paths = stat_targets(state.range(0));
+  const auto views = std::vector<std::string_view>(paths.begin(), paths.end());
+
+  auto ring = std::optional<StatRing>{};
+  try {
+    ring.emplace();
+  } catch (const std::system_error &e) {
+    state.SkipWithError(e.what());
+    return;
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ring->stat(views));
+  }
+
+  state.SetItemsProcessed(state.iterations() *
+                          static_cast<std::int64_t>(paths.size()));
+}
+
+// 1k, 100k and 1M compile rules.
+void
+sizes(benchmark::internal::Benchmark *b) {
+  b->Arg(1000)->Arg(100000)->Arg(1000000)->Unit(benchmark::kMillisecond);
+}
+} // namespace
+
+BENCHMARK(BM_ActionsViaSystem)
+    ->Arg(1000)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_ActionsViaShell)
+    ->Arg(1000)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_ActionsViaSpawn)
+    ->Arg(1000)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_ScanIdentifiers)
+    ->Arg(static_cast<int>(scan::Isa::Scalar))
+    ->Arg(static_cast<int>(scan::Isa::Sse2))
+    ->Arg(static_cast<int>(scan::Isa::Avx2));
+BENCHMARK(BM_Lex)->Apply(sizes);
+BENCHMARK(BM_Parse)->Apply(sizes);
+BENCHMARK(BM_LexParseResolve)->Apply(sizes);
+BENCHMARK(BM_Get)->Apply(sizes);
+BENCHMARK(BM_DryRun)->Apply(sizes);
+BENCHMARK(BM_StatEachPath)
+    ->Arg(10000)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_StatRing)
+    ->Arg(10000)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
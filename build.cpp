@@ -0,0 +1,730 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <stack>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "build.h"
+#include "builddb.h"
+#include "exec.h"
+#include "executor.h"
+#include "fab.h"
+#include "hash.h"
+#include "printer.h"
+#include "statcache.h"
+#include "statring.h"
+#include "trace.h"
+
+namespace {
+constexpr int CMD_OK = 0;
+
+template <typename T>
+using Ref = std::reference_wrapper<T>;
+
+namespace detail {
+// The targets whose actions a dry run has printed. Anything that depends on
+// one of them is out of date too, as it would be had those actions run.
+class [[nodiscard]] Printed {
+  std::mutex m_lock = {};
+  std::unordered_set<std::string_view> m_targets = {};
+
+public:
+  void add(std::string_view target) {
+    const auto lock = std::scoped_lock{m_lock};
+    m_targets.insert(target);
+  }
+
+  [[nodiscard]] bool any_of(const std::vector<std::string_view> &paths) {
+    const auto lock = std::scoped_lock{m_lock};
+    return std::ranges::any_of(
+        paths, [this](auto p) { return m_targets.contains(p); });
+  }
+};
+
+// Everything a job needs to evaluate a rule, shared by every job in a build.
+struct [[nodiscard]] Context {
+  const BuildOptions &options;
+  StatCache &cache;
+  BuildDb *db;
+  Printer &printer;
+  Printed &printed;
+};
+
+// Adds `cmd', and then what it printed, to `transcript'.
+void
+append(Transcript &transcript, std::string_view cmd, std::string output) {
+  transcript.emplace_back(Stream::Err, std::string{cmd} + '\n');
+  if (!output.empty()) {
+    transcript.emplace_back(Stream::Out, std::move(output));
+  }
+}
+
+void
+run_script(const std::vector<std::string_view> &cmds,
+           Transcript &transcript) {
+  auto outputs = std::vector<std::string>{};
+  const auto statuses = ::run_script(cmds, &outputs);
+  for (std::size_t i = 0; i < outputs.size(); ++i) {
+    append(transcript, cmds[i], std::move(outputs[i]));
+  }
+
+  for (std::size_t i = 0; i < statuses.size(); ++i) {
+    if (SCRIPT_CUT_SHORT == statuses[i]) {
+      throw std::runtime_error("could not run command: " +
+                               std::string{cmds[i]} +
+                               " (exited the shell before the rest ran)");
+    }
+
+    if (CMD_OK != statuses[i]) {
+      throw std::runtime_error("could not run command: " +
+                               std::string{cmds[i]} +
+                               " (exit status " + std::to_string(statuses[i]) +
+                               ")");
+    }
+  }
+}
+
+// Runs `cmds' with their output captured, then hands the whole lot to the
+// printer -- also when one of them fails, so it comes out ahead of the error.
+void
+run_cmds(const std::vector<std::string_view> &cmds, const Context &ctx) {
+  auto transcript = Transcript{};
+
+  if (ctx.options.dry_run) {
+    auto text = std::string{};
+    for (const auto &cmd : cmds) {
+      text.append(cmd);
+      text += '\n';
+    }
+
+    transcript.emplace_back(Stream::Out, std::move(text));
+    ctx.printer.print(std::move(transcript));
+    return;
+  }
+
+  try {
+    if (ctx.options.one_shell) {
+      const auto span = trace::Span{"action", "one shell"};
+      run_script(cmds, transcript);
+    } else {
+      for (const auto &cmd : cmds) {
+        const auto span = trace::Span{"action", cmd};
+        auto output = std::string{};
+        const auto status = run_command(cmd, &output);
+        append(transcript, cmd, std::move(output));
+
+        if (CMD_OK != status) {
+          throw std::runtime_error("could not run command: " +
+                                   std::string{cmd});
+        }
+      }
+    }
+  } catch (...) {
+    ctx.printer.print(std::move(transcript));
+    throw;
+  }
+
+  ctx.printer.print(std::move(transcript));
+}
+
+// Whether `record' describes `rule' as it stands: same prerequisites, and a
+// target nobody has touched since the record was written.
+[[nodiscard]] bool
+describes(const RuleState &record, const Rule &rule, const FileMeta &target) {
+  return to_ticks(target.mtime) == record.target_mtime &&
+         std::ranges::equal(record.prereqs, rule.prereqs, std::equal_to<>{},
+                            &PrereqState::path);
+}
+
+// Whether every prerequisite still has the content it had when `record' was
+// written. Only prerequisites whose mtime moved get hashed; `moved' reports
+// whether there were any.
+[[nodiscard]] bool
+unchanged(const RuleState &record, const Context &ctx, bool &moved) {
+  for (const auto &prev : record.prereqs) {
+    const auto meta = ctx.cache.get(prev.path);
+    const auto ticks = to_ticks(meta.mtime);
+
+    if (ticks == prev.mtime) {
+      continue;
+    }
+
+    moved = true;
+    const auto hash = meta.exists ? ctx.db->hash(prev.path, ticks) : NO_HASH;
+    if (NO_HASH == hash || hash != prev.hash) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Identifies the exact commands `rule' runs, after macro expansion.
+[[nodiscard]] std::uint64_t
+fingerprint(const Rule &rule) {
+  auto h = hash_bytes({});
+  for (const auto &action : rule.actions) {
+    h = hash_combine(h, hash_bytes(action));
+  }
+
+  return h;
+}
+
+// Logs the state of `rule's target and prerequisites as they are now, and
+// that its actions took `duration' nanoseconds when they last ran.
+void
+remember(const Rule &rule, const Context &ctx, std::int64_t duration) {
+  if (!ctx.db || ctx.options.dry_run) {
+    return;
+  }
+
+  const auto target = ctx.cache.get(rule.target);
+  if (!target.exists) {
+    return;
+  }
+
+  auto state = RuleState{.target_mtime = to_ticks(target.mtime),
+                         .command = fingerprint(rule),
+                         .prereqs = {},
+                         .duration = duration};
+  state.prereqs.reserve(rule.prereqs.size());
+
+  for (auto p : rule.prereqs) {
+    const auto meta = ctx.cache.get(p);
+    const auto ticks = to_ticks(meta.mtime);
+    state.prereqs.push_back(PrereqState{
+        .path = std::string{p},
+        .mtime = ticks,
+        .hash = meta.exists ? ctx.db->hash(p, ticks) : NO_HASH,
+    });
+  }
+
+  ctx.db->record(rule.target, std::move(state));
+}
+
+void
+eval(const Rule &rule, const Context &ctx) {
+  // A dry run goes on as though whatever it printed had run.
+  const auto printed_prereq =
+      ctx.options.dry_run && ctx.printed.any_of(rule.prereqs);
+
+  if (rule.is_phony()) {
+    if (printed_prereq) {
+      ctx.printed.add(rule.target);
+    }
+
+    return;
+  }
+
+  // Covers the whole check; when the rule runs, its actions nest inside.
+  const auto span = trace::Span{"rule", rule.target};
+
+  const auto run = [&] {
+    const auto start = std::chrono::steady_clock::now();
+    run_cmds(rule.actions, ctx);
+    const auto took = std::chrono::steady_clock::now() - start;
+
+    if (ctx.options.dry_run) {
+      ctx.printed.add(rule.target);
+    }
+
+    ctx.cache.invalidate(rule.target);
+    remember(
+        rule, ctx,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(took).count());
+  };
+
+  // `target' doesn't exist, or a prereq would have been rebuilt -- it must
+  // be out of date!
+  const auto target = ctx.cache.get(rule.target);
+  if (!target.exists || printed_prereq) {
+    run();
+    return;
+  }
+
+  const auto *record = ctx.db ? ctx.db->find(rule.target) : nullptr;
+  const auto last = record ? record->duration : std::int64_t{0};
+
+  // `target' was built by different commands than the rule has now -- say,
+  // because a macro changed.
+  if (record && fingerprint(rule) != record->command) {
+    run();
+    return;
+  }
+
+  // `target' exists without any prereqs -- it must be up to date!
+  if (rule.prereqs.empty()) {
+    if (!record) {
+      remember(rule, ctx, last);
+    }
+
+    return;
+  }
+
+  // The log knows what the prereqs held when `target' was last built; it's
+  // out of date only if one of them now holds something else.
+  if (record && describes(*record, rule, target)) {
+    auto moved = bool{false};
+    if (!unchanged(*record, ctx, moved)) {
+      run();
+    } else if (moved) {
+      remember(rule, ctx, last);
+    }
+
+    return;
+  }
+
+  const auto times = rule.prereqs | std::views::transform([&](auto p) {
+                       return ctx.cache.get(p).mtime;
+                     });
+  const auto max = *std::ranges::max_element(times.begin(), times.end());
+
+  if (target.mtime < max) {
+    run();
+  } else {
+    remember(rule, ctx, last);
+  }
+}
+} // namespace detail
+
+// The closure of a target laid out for scheduling. `rules' is in the order a
+// serial depth-first walk evaluates them, which is also the order a single job
+// runs them in. `paths' holds, once each, every file evaluating them can stat.
+struct [[nodiscard]] Plan {
+  std::vector<Ref<const Rule>> rules;
+  std::vector<std::vector<std::size_t>> dependents;
+  std::vector<std::size_t> pending;
+  std::vector<std::string_view> paths;
+};
+
+// `stale', if given, marks the rules worth evaluating; any other rule is
+// taken to be up to date and left out of the plan, just like a leaf.
+//
+//   cases
+//   ------------------------------------------
+//   (1) current node is a leaf
+//         - append node; mark visited; pop
+//   (2) current node has deps
+//         - if all deps are visited
+//             append node; mark visited; pop
+//         - else
+//             filter unvisited nodes; push
+Plan
+make_plan(const Graph &graph, Graph::Id root,
+          const std::vector<bool> *stale = nullptr) {
+  constexpr auto NONE = std::numeric_limits<std::size_t>::max();
+
+  auto stack = std::stack<Graph::Id>{};
+  auto visited = std::vector<bool>(graph.size());
+  auto ids = std::vector<Graph::Id>{};
+  auto slots = std::vector<std::size_t>(graph.size(), NONE);
+  auto plan = Plan{};
+
+  const auto utd = [&v = std::as_const(visited), &graph,
+                    stale](Graph::Id d) {
+    return v[d] || graph.is_leaf(d) || (stale && !(*stale)[d]);
+  };
+  const auto not_utd = std::not_fn(utd);
+  const auto append = [&](Graph::Id id) {
+    assert(!visited[id]);
+    visited[id] = true;
+    slots[id] = plan.rules.size();
+    ids.push_back(id);
+    plan.rules.emplace_back(graph.rule(id));
+  };
+
+  if (!utd(root)) {
+    stack.push(root);
+  }
+
+  while (!stack.empty()) {
+    const auto top = stack.top();
+    const auto deps = graph.prereqs(top);
+
+    if (visited[top]) {
+      stack.pop();
+      continue;
+    }
+
+    if (std::ranges::all_of(deps, utd)) {
+      append(top);
+      stack.pop();
+    } else {
+      for (auto d : deps | std::views::filter(not_utd) | std::views::reverse) {
+        stack.push(d);
+      }
+    }
+  }
+
+  plan.dependents.resize(plan.rules.size());
+  plan.pending.resize(plan.rules.size());
+
+  // Phony targets are never statted; everything else a rule names may be.
+  auto listed = std::vector<bool>(graph.size());
+  const auto list = [&](Graph::Id id) {
+    if (!listed[id]) {
+      listed[id] = true;
+      plan.paths.push_back(graph.name(id));
+    }
+  };
+
+  // A prerequisite listed twice is still only one edge; `counted' remembers
+  // which rule last counted each one.
+  auto counted = std::vector<std::size_t>(graph.size(), NONE);
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    if (!plan.rules[i].get().is_phony()) {
+      list(ids[i]);
+    }
+
+    for (auto d : graph.prereqs(ids[i])) {
+      list(d);
+
+      if (NONE != slots[d] && i != counted[d]) {
+        counted[d] = i;
+        plan.dependents[slots[d]].push_back(i);
+        ++plan.pending[i];
+      }
+    }
+  }
+
+  return plan;
+}
+
+// What the build log says each rule in `plan' took the last time it ran, in
+// nanoseconds. Rules that have never run took no time.
+[[nodiscard]] std::vector<std::int64_t>
+durations(const Plan &plan, const BuildDb *db) {
+  auto out = std::vector<std::int64_t>(plan.rules.size());
+  for (std::size_t i = 0; db && i < plan.rules.size(); ++i) {
+    if (const auto *record = db->find(plan.rules[i].get().target)) {
+      out[i] = record->duration;
+    }
+  }
+
+  return out;
+}
+
+// The length of the longest chain from each rule, through its dependents, to
+// the end of the plan. Every rule counts for at least a nanosecond so that
+// with nothing recorded the deepest chain is the longest.
+[[nodiscard]] std::vector<std::uint64_t>
+remaining(const Plan &plan, const std::vector<std::int64_t> &durations) {
+  auto out = std::vector<std::uint64_t>(plan.rules.size());
+
+  // Dependents always come after the rules they depend on.
+  for (auto i = plan.rules.size(); 0 < i--;) {
+    auto longest = std::uint64_t{0};
+    for (auto d : plan.dependents[i]) {
+      longest = std::max(longest, out[d]);
+    }
+
+    out[i] = longest + static_cast<std::uint64_t>(
+                           std::max<std::int64_t>(durations[i], 1));
+  }
+
+  return out;
+}
+
+// Prints the chain of rules that bounds how long `plan' takes to build, going
+// by `durations', in the order they run.
+void
+print_critical_path(std::ostream &os, const Plan &plan,
+                    const std::vector<std::int64_t> &durations) {
+  if (plan.rules.empty()) {
+    return;
+  }
+
+  const auto ms = [](std::int64_t ns) {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::nanoseconds{ns})
+        .count();
+  };
+
+  const auto lengths = remaining(plan, durations);
+  const auto longest = [&](const auto &candidates) {
+    return *std::ranges::max_element(
+        candidates, {}, [&](std::size_t i) { return lengths[i]; });
+  };
+
+  auto chain = std::vector<std::size_t>{
+      longest(std::views::iota(std::size_t{0}, plan.rules.size()))};
+  while (!plan.dependents[chain.back()].empty()) {
+    chain.push_back(longest(plan.dependents[chain.back()]));
+  }
+
+  auto total = std::int64_t{0};
+  for (auto i : chain) {
+    total += durations[i];
+  }
+
+  os << std::fixed << std::setprecision(3);
+  os << "critical path: " << ms(total) << "ms\n";
+  for (auto i : chain) {
+    os << "  " << ms(durations[i]) << "ms " << plan.rules[i].get().target
+       << "\n";
+  }
+}
+
+// Stats every path in `plan' before any rule is evaluated, so the walk finds
+// them all in `cache' instead of waiting on each in turn -- on a network
+// filesystem, a round trip apiece. They go to the kernel in batches through an
+// io_uring where there is one, and are spread over a pool of threads where
+// there isn't. A path that can't be statted is left for the walk to report
+// where it comes up. Paths `cache' already knows -- in watch mode or in a
+// server, most of them -- are left alone.
+void
+prefetch(const Plan &plan, StatCache &cache) {
+  constexpr auto CHUNK = std::size_t{64};
+  constexpr auto THREADS = std::size_t{16};
+
+  auto paths = std::vector<std::string_view>{};
+  for (auto path : plan.paths) {
+    if (!cache.has(path)) {
+      paths.push_back(path);
+    }
+  }
+
+  const auto chunks = (paths.size() + CHUNK - 1) / CHUNK;
+  if (chunks <= 1) {
+    return;
+  }
+
+  const auto span = trace::Span{"phase", "prefetch"};
+
+  try {
+    auto ring = StatRing{};
+    const auto metas = ring.stat(paths);
+    for (std::size_t i = 0; i < metas.size(); ++i) {
+      if (metas[i]) {
+        cache.put(paths[i], *metas[i]);
+      }
+    }
+
+    return;
+  } catch (const std::system_error &) {
+    // No io_uring, or one that can't stat.
+  }
+
+  auto pool = Executor{static_cast<unsigned>(std::min(chunks, THREADS))};
+
+  for (std::size_t i = 0; i < paths.size(); i += CHUNK) {
+    pool.spawn([&paths, &cache, i] {
+      const auto end = std::min(i + CHUNK, paths.size());
+      for (auto j = i; j < end; ++j) {
+        try {
+          static_cast<void>(cache.get(paths[j]));
+        } catch (const std::runtime_error &) {
+        }
+      }
+    });
+  }
+
+  pool.wait();
+}
+
+// Drives a Plan on an Executor. Each rule waits on a count of its unfinished
+// prerequisites; whichever job finishes the last of them spawns the rule onto
+// its own worker. Of the rules that are ready, the ones with the longest chain
+// of work still behind them go first. The first failure stops new rules from
+// starting, lets the running ones drain, and is rethrown to the caller.
+class [[nodiscard]] ParallelBuild {
+  const Plan &m_plan;
+  const std::vector<std::uint64_t> &m_priority;
+  const detail::Context &m_ctx;
+  Executor &m_executor;
+  std::unique_ptr<std::atomic<std::size_t>[]> m_pending;
+  std::atomic<bool> m_failed = false;
+  std::exception_ptr m_error = nullptr;
+  std::mutex m_error_lock = {};
+
+  void spawn(std::size_t idx) {
+    m_executor.spawn([this, idx] { run(idx); }, m_priority[idx]);
+  }
+
+  void run(std::size_t idx) {
+    if (m_failed.load()) {
+      return;
+    }
+
+    try {
+      detail::eval(m_plan.rules[idx], m_ctx);
+    } catch (...) {
+      const auto lock = std::scoped_lock{m_error_lock};
+      if (!m_error) {
+        m_error = std::current_exception();
+      }
+
+      m_failed.store(true);
+      return;
+    }
+
+    for (auto d : m_plan.dependents[idx]) {
+      if (1 == m_pending[d].fetch_sub(1)) {
+        spawn(d);
+      }
+    }
+  }
+
+public:
+  ParallelBuild(const Plan &plan, const std::vector<std::uint64_t> &priority,
+                const detail::Context &ctx, Executor &executor)
+      : m_plan(plan)
+      , m_priority(priority)
+      , m_ctx(ctx)
+      , m_executor(executor)
+      , m_pending(
+            std::make_unique<std::atomic<std::size_t>[]>(plan.rules.size())) {
+    for (std::size_t i = 0; i < plan.rules.size(); ++i) {
+      m_pending[i].store(plan.pending[i]);
+    }
+  }
+
+  void operator()() {
+    for (std::size_t i = 0; i < m_plan.rules.size(); ++i) {
+      if (0 == m_plan.pending[i]) {
+        spawn(i);
+      }
+    }
+
+    m_executor.wait();
+
+    if (m_error) {
+      std::rethrow_exception(m_error);
+    }
+  }
+};
+
+// Every id in `changed' and everything that depends on one of them.
+[[nodiscard]] std::vector<bool>
+downstream(const Graph &graph, const std::vector<Graph::Id> &changed) {
+  auto marked = std::vector<bool>(graph.size());
+  auto stack = std::stack<Graph::Id>{};
+
+  const auto mark = [&](Graph::Id id) {
+    if (!marked[id]) {
+      marked[id] = true;
+      stack.push(id);
+    }
+  };
+
+  std::ranges::for_each(changed, mark);
+
+  while (!stack.empty()) {
+    const auto top = stack.top();
+    stack.pop();
+    std::ranges::for_each(graph.dependents(top), mark);
+  }
+
+  return marked;
+}
+
+void
+run(const Plan &plan, const BuildOptions &options, StatCache &cache,
+    BuildDb *db) {
+  assert(0 < options.jobs);
+
+  auto printer = Printer{options.output_log};
+  auto printed = detail::Printed{};
+  const auto ctx = detail::Context{.options = options,
+                                   .cache = cache,
+                                   .db = db,
+                                   .printer = printer,
+                                   .printed = printed};
+  const auto jobs = std::min<std::size_t>(options.jobs, plan.rules.size());
+
+  auto executor = std::optional<Executor>{};
+  const auto report = [&] {
+    if (!options.stats) {
+      return;
+    }
+
+    if (executor) {
+      std::cerr << executor->stats();
+    } else {
+      std::cerr << "scheduler: serial, " << plan.rules.size() << " tasks\n";
+    }
+
+    std::cerr << cache;
+
+    if (db) {
+      std::cerr << "build log: " << db->size() << " records\n";
+    }
+  };
+
+  try {
+    prefetch(plan, cache);
+
+    if (jobs <= 1) {
+      for (const auto &rule : plan.rules) {
+        detail::eval(rule, ctx);
+      }
+    } else {
+      executor.emplace(static_cast<unsigned>(jobs));
+      const auto priority = remaining(plan, durations(plan, db));
+      ParallelBuild{plan, priority, ctx, executor.value()}();
+    }
+  } catch (...) {
+    printer.close();
+    report();
+    throw;
+  }
+
+  printer.close();
+  report();
+
+  if (options.critical_path) {
+    print_critical_path(std::cerr, plan, durations(plan, db));
+  }
+}
+} // namespace
+
+void
+build(const Environment &env, std::string_view target,
+      const BuildOptions &options, StatCache &cache, BuildDb *db) {
+  // Looked up by name first so an unknown target gets the usual error.
+  const auto &root = env.get(target);
+  run(make_plan(env.graph, *env.graph.find(root.target)), options, cache, db);
+}
+
+void
+rebuild(const Environment &env, std::string_view target,
+        const std::vector<std::string_view> &changed,
+        const BuildOptions &options, StatCache &cache, BuildDb *db) {
+  const auto &root = env.get(target);
+
+  auto ids = std::vector<Graph::Id>{};
+  for (auto path : changed) {
+    if (const auto id = env.graph.find(path)) {
+      cache.invalidate(env.graph.name(*id));
+      ids.push_back(*id);
+    }
+  }
+
+  const auto stale = downstream(env.graph, ids);
+  run(make_plan(env.graph, *env.graph.find(root.target), &stale), options,
+      cache, db);
+}
+
+void
+build(const Environment &env, std::string_view target,
+      const BuildOptions &options) {
+  auto cache = StatCache{};
+  build(env, target, options, cache);
+}
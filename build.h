@@ -0,0 +1,65 @@
+#ifndef BUILD_H
+#define BUILD_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "builddb.h"
+#include "fab.h"
+#include "statcache.h"
+
+struct BuildOptions {
+  // Upper bound on the number of rules whose actions may run at once.
+  unsigned jobs = 1;
+  // Run each rule's actions in a single shell that stops at the first failing
+  // line, rather than in a process per line.
+  bool one_shell = false;
+  // Print the scheduler's and the stat cache's counters to stderr once the
+  // build finishes.
+  bool stats = false;
+  // Print the chain of rules whose recorded durations bound how long the
+  // build takes, once it finishes.
+  bool critical_path = false;
+  // Print the actions of every out of date rule to stdout instead of running
+  // them. A rule that depends on one of those is taken to be out of date too,
+  // as it would be once they ran. Nothing is logged.
+  bool dry_run = false;
+  // If not empty, where to also write everything the actions print, compressed
+  // with gzip.
+  std::string output_log = {};
+};
+
+// Brings `target' up to date by evaluating every rule in its closure. Rules
+// are started as soon as all of their prerequisites have finished, on a
+// work-stealing pool of `options.jobs' threads. With a single job they run on
+// the calling thread in exactly the order of a serial depth-first walk.
+//
+// A rule's actions write into pipes rather than to fab's stdout and stderr.
+// Once the rule is done, its commands and their output are printed together,
+// in the order rules finish, by a thread that does nothing else.
+void build(const Environment &env, std::string_view target,
+           const BuildOptions &options);
+
+// As above, but file metadata comes from -- and is kept in -- `cache', which
+// may outlive the build. Paths in `env' must outlive `cache'.
+//
+// Given a build log, a target whose mtime is older than a prerequisite's is
+// still up to date if every prerequisite has the same content it had when the
+// log last saw the target. Each rule that runs, or is found up to date, is
+// logged.
+void build(const Environment &env, std::string_view target,
+           const BuildOptions &options, StatCache &cache,
+           BuildDb *db = nullptr);
+
+// Brings `target' up to date after the files in `changed' were modified,
+// evaluating only the rules in its closure that depend on one of them --
+// directly or through other rules. Every other rule is assumed to still be up
+// to date, as it would be if `cache' saw the last build. Paths that aren't in
+// `env' are ignored.
+void rebuild(const Environment &env, std::string_view target,
+             const std::vector<std::string_view> &changed,
+             const BuildOptions &options, StatCache &cache,
+             BuildDb *db = nullptr);
+
+#endif // BUILD_H
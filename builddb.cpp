@@ -0,0 +1,248 @@
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "builddb.h"
+#include "hash.h"
+#include "serial.h"
+
+namespace {
+// Bump the trailing digits whenever the record layout changes; a log with a
+// different header is discarded.
+constexpr auto MAGIC = std::string_view{"fabdb003"};
+
+// Don't bother compacting logs smaller than this many records.
+constexpr std::size_t MIN_COMPACT = 1024;
+
+// Flush appended records once this much is buffered.
+constexpr std::size_t FLUSH_BYTES = 1 << 16;
+
+void
+encode(std::string &out, std::string_view target, const RuleState &state) {
+  auto body = std::string{};
+  put(body, target);
+  put(body, state.target_mtime);
+  put(body, state.command);
+  put(body, state.duration);
+  put(body, static_cast<std::uint32_t>(state.prereqs.size()));
+
+  for (const auto &p : state.prereqs) {
+    put(body, std::string_view{p.path});
+    put(body, p.mtime);
+    put(body, p.hash);
+  }
+
+  put(out, static_cast<std::uint32_t>(body.size()));
+  out += body;
+}
+
+std::string
+read_all(int fd) {
+  auto out = std::string{};
+  auto buf = std::array<char, 1 << 16>{};
+
+  while (true) {
+    const auto n = read(fd, buf.data(), buf.size());
+    if (-1 == n && EINTR == errno) {
+      continue;
+    }
+
+    if (n <= 0) {
+      return out;
+    }
+
+    out.append(buf.data(), static_cast<std::size_t>(n));
+  }
+}
+} // namespace
+
+std::int64_t
+to_ticks(std::filesystem::file_time_type t) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             t.time_since_epoch())
+      .count();
+}
+
+BuildDb::BuildDb(std::string path)
+    : m_path(std::move(path)) {
+  load();
+}
+
+BuildDb::~BuildDb() {
+  flush();
+
+  if (-1 != m_fd) {
+    close(m_fd);
+  }
+
+  if (MIN_COMPACT < m_logged && m_records.size() * 2 < m_logged) {
+    compact();
+  }
+}
+
+void
+BuildDb::load() {
+  const auto fd = open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (-1 == fd) {
+    return;
+  }
+
+  const auto log = read_all(fd);
+  close(fd);
+
+  if (!log.starts_with(MAGIC)) {
+    // Either nothing was ever written or it's from a different version of
+    // fab. Start over.
+    unlink(m_path.c_str());
+    return;
+  }
+
+  auto in = Reader{std::string_view{log}.substr(MAGIC.size())};
+  auto good = MAGIC.size();
+
+  while (!in.empty()) {
+    const auto size = in.get<std::uint32_t>();
+    auto record = Reader{in.bytes(size)};
+
+    if (!in.ok()) {
+      break;
+    }
+
+    const auto target = record.str();
+    const auto target_mtime = record.get<std::int64_t>();
+    const auto command = record.get<std::uint64_t>();
+    auto state = RuleState{.target_mtime = target_mtime,
+                           .command = command,
+                           .prereqs = {},
+                           .duration = record.get<std::int64_t>()};
+    const auto n = record.get<std::uint32_t>();
+
+    for (std::uint32_t i = 0; i < n && record.ok(); ++i) {
+      const auto path = record.str();
+      const auto mtime = record.get<std::int64_t>();
+      const auto hash = record.get<std::uint64_t>();
+      state.prereqs.push_back(
+          PrereqState{.path = std::string{path}, .mtime = mtime, .hash = hash});
+    }
+
+    if (!record.ok()) {
+      break;
+    }
+
+    m_records.insert_or_assign(std::string{target}, std::move(state));
+    ++m_logged;
+    good += sizeof(std::uint32_t) + size;
+  }
+
+  // Drop whatever a crash left half written so new records append cleanly.
+  if (good != log.size()) {
+    if (0 != truncate(m_path.c_str(), static_cast<off_t>(good))) {
+      unlink(m_path.c_str());
+      m_records.clear();
+      m_logged = 0;
+    }
+  }
+}
+
+void
+BuildDb::flush() {
+  if (m_pending.empty()) {
+    return;
+  }
+
+  if (-1 == m_fd) {
+    m_fd = open(m_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                0644);
+
+    if (-1 != m_fd && 0 == lseek(m_fd, 0, SEEK_END)) {
+      write_all(m_fd, MAGIC);
+    }
+  }
+
+  // The log is only an optimization -- a build that can't write it still
+  // succeeds, it just can't skip as much work next time.
+  if (-1 != m_fd) {
+    write_all(m_fd, m_pending);
+  }
+
+  m_pending.clear();
+}
+
+void
+BuildDb::compact() {
+  const auto tmp = m_path + ".tmp";
+  const auto fd =
+      open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (-1 == fd) {
+    return;
+  }
+
+  auto out = std::string{MAGIC};
+  for (const auto &[target, state] : m_records) {
+    encode(out, target, state);
+  }
+
+  const auto ok = write_all(fd, out);
+  close(fd);
+
+  if (!ok || 0 != rename(tmp.c_str(), m_path.c_str())) {
+    unlink(tmp.c_str());
+  }
+}
+
+const RuleState *
+BuildDb::find(std::string_view target) const {
+  const auto lock = std::scoped_lock{m_lock};
+  const auto it = m_records.find(target);
+  return m_records.end() == it ? nullptr : &it->second;
+}
+
+void
+BuildDb::record(std::string_view target, RuleState state) {
+  const auto lock = std::scoped_lock{m_lock};
+  encode(m_pending, target, state);
+  ++m_logged;
+
+  if (const auto it = m_records.find(target); m_records.end() != it) {
+    it->second = std::move(state);
+  } else {
+    m_records.emplace(std::string{target}, std::move(state));
+  }
+
+  if (FLUSH_BYTES < m_pending.size()) {
+    flush();
+  }
+}
+
+void
+BuildDb::sync() {
+  const auto lock = std::scoped_lock{m_lock};
+  flush();
+}
+
+std::uint64_t
+BuildDb::hash(std::string_view path, std::int64_t mtime) {
+  {
+    const auto lock = std::scoped_lock{m_hashes_lock};
+    if (const auto it = m_hashes.find(path);
+        m_hashes.end() != it && mtime == it->second.first) {
+      return it->second.second;
+    }
+  }
+
+  const auto h = hash_file(path);
+
+  const auto lock = std::scoped_lock{m_hashes_lock};
+  m_hashes.insert_or_assign(std::string{path}, std::pair{mtime, h});
+  return h;
+}
+
+std::size_t
+BuildDb::size() const {
+  const auto lock = std::scoped_lock{m_lock};
+  return m_records.size();
+}
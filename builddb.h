@@ -0,0 +1,91 @@
+#ifndef BUILDDB_H
+#define BUILDDB_H
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// What a prerequisite looked like when a rule last ran -- or was last found
+// to be up to date.
+struct PrereqState {
+  std::string path;
+  std::int64_t mtime;
+  std::uint64_t hash;
+
+  bool operator==(const PrereqState &) const = default;
+};
+
+struct RuleState {
+  std::int64_t target_mtime;
+  // A hash of the rule's resolved actions.
+  std::uint64_t command;
+  std::vector<PrereqState> prereqs;
+  // How long, in nanoseconds, the rule's actions took the last time they ran.
+  std::int64_t duration = 0;
+
+  bool operator==(const RuleState &) const = default;
+};
+
+// The on-disk build log. Every record is appended to the end of the file and
+// a later record for a target replaces an earlier one, so writing never has
+// to touch what's already there. When most of the file is superseded records
+// it's rewritten on close.
+//
+// Lookups and updates may come from any job, but a target's record must only
+// be read or written by the job that evaluates that target.
+class BuildDb {
+  struct StringHash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view s) const {
+      return std::hash<std::string_view>{}(s);
+    }
+  };
+
+  template <typename V>
+  using StringMap =
+      std::unordered_map<std::string, V, StringHash, std::equal_to<>>;
+
+  const std::string m_path;
+  StringMap<RuleState> m_records = {};
+  std::size_t m_logged = 0;
+  std::string m_pending = {};
+  int m_fd = -1;
+  mutable std::mutex m_lock = {};
+
+  StringMap<std::pair<std::int64_t, std::uint64_t>> m_hashes = {};
+  std::mutex m_hashes_lock = {};
+
+  void load();
+  void flush();
+  void compact();
+
+public:
+  explicit BuildDb(std::string path);
+  ~BuildDb();
+
+  BuildDb(const BuildDb &) = delete;
+  BuildDb &operator=(const BuildDb &) = delete;
+
+  // Returns the last record for `target', or nullptr if there isn't one.
+  [[nodiscard]] const RuleState *find(std::string_view target) const;
+  void record(std::string_view target, RuleState state);
+  // Writes out every record so far. A long-lived process calls this between
+  // builds so that nothing is lost if it's killed.
+  void sync();
+
+  // Hashes the contents of `path', reusing the result for the rest of the run
+  // as long as its mtime doesn't change.
+  [[nodiscard]] std::uint64_t hash(std::string_view path, std::int64_t mtime);
+
+  [[nodiscard]] std::size_t size() const;
+};
+
+// The representation of an mtime in the build log.
+std::int64_t to_ticks(std::filesystem::file_time_type t);
+
+#endif // BUILDDB_H
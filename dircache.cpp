@@ -0,0 +1,68 @@
+#include <dirent.h>
+
+#include "dircache.h"
+#include "hash.h"
+
+DirCache::Entry &
+DirCache::list(const std::string &dir) {
+  if (const auto it = m_dirs.find(dir); m_dirs.end() != it) {
+    return it->second;
+  }
+
+  auto entry = Entry{.names = {}};
+
+  if (auto *d = opendir(dir.c_str())) {
+    while (const auto *e = readdir(d)) {
+      entry.names.emplace(e->d_name);
+    }
+
+    closedir(d);
+  }
+
+  return m_dirs.emplace(dir, std::move(entry)).first->second;
+}
+
+bool
+DirCache::exists(std::string_view path) {
+  const auto slash = path.rfind('/');
+  const auto dir = std::string_view::npos == slash
+                       ? std::string{"."}
+                       : std::string{path.substr(0, 0 == slash ? 1 : slash)};
+  const auto name = std::string{
+      std::string_view::npos == slash ? path : path.substr(slash + 1)};
+
+  auto &entry = list(dir);
+  const auto found = entry.names.contains(name);
+  entry.asked.insert(name);
+  return found;
+}
+
+std::uint64_t
+DirCache::found(std::string_view dir,
+                const std::vector<std::string_view> &names) {
+  const auto &entry = list(std::string{dir});
+
+  auto h = hash_bytes({});
+  for (auto name : names) {
+    if (entry.names.contains(std::string{name})) {
+      h = hash_combine(h, hash_bytes(name));
+    }
+  }
+
+  return h;
+}
+
+std::vector<Listing>
+DirCache::listings() {
+  auto out = std::vector<Listing>{};
+  out.reserve(m_dirs.size());
+
+  for (const auto &[dir, entry] : m_dirs) {
+    auto names = std::vector<std::string_view>{entry.asked.begin(),
+                                               entry.asked.end()};
+    const auto h = found(dir, names);
+    out.push_back(Listing{.dir = dir, .names = std::move(names), .found = h});
+  }
+
+  return out;
+}
@@ -0,0 +1,48 @@
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// A directory, the names that were asked about in it, and found(), a hash of
+// which of those it had. Whatever was decided from the listing still holds as
+// long as the same names are there; other entries coming and going -- fab's
+// own logs, say -- don't matter.
+struct Listing {
+  std::string_view dir;
+  std::vector<std::string_view> names;
+  std::uint64_t found;
+};
+
+// Answers "does this file exist?" from one listing of its directory, so asking
+// about many files in one directory costs a single readdir(3) pass instead of
+// a stat(2) each. Listings are taken once and never refreshed.
+class DirCache {
+  struct Entry {
+    std::unordered_set<std::string> names;
+    // Every name exists() was asked about, sorted.
+    std::set<std::string> asked = {};
+  };
+
+  std::unordered_map<std::string, Entry> m_dirs = {};
+
+  Entry &list(const std::string &dir);
+
+public:
+  [[nodiscard]] bool exists(std::string_view path);
+
+  // Hashes which of `names' `dir' has.
+  [[nodiscard]] std::uint64_t found(std::string_view dir,
+                                    const std::vector<std::string_view> &names);
+
+  // Every directory listed so far. The views are only valid as long as the
+  // cache is.
+  [[nodiscard]] std::vector<Listing> listings();
+};
+
+#endif // DIRCACHE_H
@@ -0,0 +1,439 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <initializer_list>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "exec.h"
+
+extern char **environ;
+
+namespace {
+// Words that only mean something to a shell: POSIX's reserved words, its
+// special builtins, and the regular builtins that act on the shell's own state
+// or have no standalone program -- plus a few common extensions.
+constexpr auto SHELL_WORDS = std::array<std::string_view, 52>{
+    "!",        ".",        ":",        "[[",       "]]",       "alias",
+    "bg",       "break",    "case",     "cd",       "command",  "continue",
+    "do",       "done",     "elif",     "else",     "esac",     "eval",
+    "exec",     "exit",     "export",   "fc",       "fg",       "fi",
+    "for",      "function", "getopts",  "hash",     "if",       "in",
+    "jobs",     "local",    "read",     "readonly", "return",   "select",
+    "set",      "shift",    "source",   "then",     "times",    "trap",
+    "type",     "ulimit",   "umask",    "unalias",  "unset",    "until",
+    "wait",     "while",    "{",        "}",
+};
+
+[[nodiscard]] bool
+is_plain(char c) {
+  return std::isalnum(static_cast<unsigned char>(c)) ||
+         std::string_view{"_-./,:+@%="}.find(c) != std::string_view::npos;
+}
+
+[[nodiscard]] bool
+is_blank(char c) {
+  return ' ' == c || '\t' == c;
+}
+
+[[nodiscard]] int
+decode(int status) {
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  }
+
+  if (WIFSIGNALED(status)) {
+    return 128 + WTERMSIG(status);
+  }
+
+  return status;
+}
+
+[[nodiscard]] int
+wait_for(pid_t pid) {
+  auto status = int{};
+  while (-1 == waitpid(pid, &status, 0)) {
+    if (EINTR != errno) {
+      throw std::system_error(errno, std::generic_category(),
+                              "could not wait on child");
+    }
+  }
+
+  return decode(status);
+}
+
+// A child about to be started, and the pipes that carry whatever it writes to
+// some of its descriptors back to the parent.
+class [[nodiscard]] Child {
+  posix_spawn_file_actions_t m_actions = {};
+  // Read ends, and what each one is read into.
+  std::vector<std::pair<int, std::string *>> m_pipes = {};
+  // Write ends, and the descriptors each one becomes in the child.
+  std::vector<std::pair<int, std::vector<int>>> m_routes = {};
+  std::vector<int> m_write_ends = {};
+  std::string *m_err = nullptr;
+
+  // Sets up the child's descriptors. Until now a write end may share its
+  // number with a descriptor some other pipe is meant to become, and the
+  // child would dup2() one over the other; any that do are moved above them
+  // all first.
+  void route() {
+    auto targets = std::vector<int>{};
+    for (const auto &[end, fds] : m_routes) {
+      targets.insert(targets.end(), fds.begin(), fds.end());
+    }
+    const auto max = std::ranges::max(targets);
+
+    for (auto &[end, fds] : m_routes) {
+      if (std::ranges::find(targets, end) != targets.end()) {
+        const auto moved = fcntl(end, F_DUPFD_CLOEXEC, max + 1);
+        if (-1 == moved) {
+          throw std::system_error(errno, std::generic_category(),
+                                  "could not move pipe");
+        }
+
+        std::ranges::replace(m_write_ends, end, moved);
+        close(end);
+        end = moved;
+      }
+
+      // dup2() onto the same descriptor would leave it close-on-exec, which
+      // the move rules out.
+      for (auto fd : fds) {
+        posix_spawn_file_actions_adddup2(&m_actions, end, fd);
+      }
+    }
+  }
+
+  void close_write_ends() {
+    for (auto fd : m_write_ends) {
+      close(fd);
+    }
+    m_write_ends.clear();
+  }
+
+public:
+  Child() { posix_spawn_file_actions_init(&m_actions); }
+
+  ~Child() {
+    posix_spawn_file_actions_destroy(&m_actions);
+    close_write_ends();
+    for (auto [fd, into] : m_pipes) {
+      close(fd);
+    }
+  }
+
+  Child(const Child &) = delete;
+  Child &operator=(const Child &) = delete;
+
+  // Collects whatever the child writes to any of `fds' into `into', through
+  // a single pipe so that it stays in the order it was written.
+  void capture(std::initializer_list<int> fds, std::string &into) {
+    auto ends = std::array<int, 2>{};
+    if (-1 == pipe2(ends.data(), O_CLOEXEC)) {
+      throw std::system_error(errno, std::generic_category(),
+                              "could not create pipe");
+    }
+
+    m_pipes.emplace_back(ends[0], &into);
+    m_write_ends.push_back(ends[1]);
+    m_routes.emplace_back(ends[1], fds);
+    if (std::ranges::find(fds, STDERR_FILENO) != fds.end()) {
+      m_err = &into;
+    }
+  }
+
+  // Starts `file' and returns its pid, or NONE if it couldn't be found.
+  [[nodiscard]] Option<pid_t> start(const char *file, char *const argv[]) {
+    if (!m_routes.empty()) {
+      route();
+    }
+
+    auto pid = pid_t{};
+    const auto rc =
+        posix_spawnp(&pid, file, &m_actions, nullptr, argv, environ);
+
+    // Only the child may hold the write ends, or they'd never see EOF.
+    close_write_ends();
+
+    if (ENOENT == rc) {
+      const auto msg = std::string{file} + ": command not found\n";
+      if (m_err) {
+        *m_err += msg;
+      } else {
+        std::cerr << msg;
+      }
+
+      return {};
+    }
+
+    if (0 != rc) {
+      throw std::system_error(rc, std::generic_category(),
+                              std::string{"could not spawn "} + file);
+    }
+
+    return pid;
+  }
+
+  // Reads every captured descriptor until the child, and anything it left
+  // running, has closed them all.
+  void drain() {
+    auto buf = std::array<char, 16 * 1024>{};
+
+    while (!m_pipes.empty()) {
+      auto fds = std::vector<pollfd>{};
+      for (auto [fd, into] : m_pipes) {
+        fds.push_back(pollfd{.fd = fd, .events = POLLIN, .revents = 0});
+      }
+
+      if (-1 == poll(fds.data(), fds.size(), -1)) {
+        if (EINTR == errno) {
+          continue;
+        }
+
+        throw std::system_error(errno, std::generic_category(),
+                                "could not wait on child's output");
+      }
+
+      for (std::size_t i = fds.size(); 0 < i--;) {
+        if (0 == fds[i].revents) {
+          continue;
+        }
+
+        auto &[fd, into] = m_pipes[i];
+        const auto n = read(fd, buf.data(), buf.size());
+        if (-1 == n && EINTR == errno) {
+          continue;
+        }
+
+        if (-1 == n) {
+          throw std::system_error(errno, std::generic_category(),
+                                  "could not read child's output");
+        }
+
+        if (0 == n) {
+          close(fd);
+          m_pipes.erase(m_pipes.begin() + static_cast<std::ptrdiff_t>(i));
+        } else {
+          into->append(buf.data(), static_cast<std::size_t>(n));
+        }
+      }
+    }
+  }
+};
+
+[[nodiscard]] int
+spawn(const char *file, char *const argv[], std::string *output) {
+  auto child = Child{};
+  if (output) {
+    child.capture({STDOUT_FILENO, STDERR_FILENO}, *output);
+  }
+
+  const auto pid = child.start(file, argv);
+  if (!pid) {
+    return CMD_NOT_FOUND;
+  }
+
+  child.drain();
+  return wait_for(pid.value());
+}
+
+// Quotes `s' so that sh(1) reads it back as a single literal word.
+[[nodiscard]] std::string
+quote(std::string_view s) {
+  auto out = std::string{"'"};
+
+  for (auto c : s) {
+    if ('\'' == c) {
+      out += "'\\''";
+    } else {
+      out += c;
+    }
+  }
+
+  return out + "'";
+}
+
+// Marks where each line's output starts when it's captured.
+constexpr auto LINE_MARK = std::string_view{"\0fab\0", 5};
+
+// Wraps each line so that the shell echoes it -- or, when `marked', writes
+// LINE_MARK in its place -- reports its exit status on SCRIPT_STATUS_FD, and
+// stops at the first failure. The line itself runs with the status pipe closed
+// so that nothing it leaves behind can hold it open.
+[[nodiscard]] std::string
+make_script(const std::vector<std::string_view> &cmds, bool marked) {
+  const auto fd = std::to_string(SCRIPT_STATUS_FD);
+  auto script = std::string{};
+
+  for (const auto &cmd : cmds) {
+    if (marked) {
+      script += "printf '\\000fab\\000'\n";
+    } else {
+      script += "printf '%s\\n' " + quote(cmd) + " >&2\n";
+    }
+    script += "{ :\n";
+    script += cmd;
+    script += "\n} " + fd + ">&-\n";
+    script += "fab_status=$?\n";
+    script += "echo \"$fab_status\" >&" + fd + "\n";
+    script += "[ \"$fab_status\" -eq 0 ] || exit \"$fab_status\"\n";
+  }
+
+  return script;
+}
+
+// Splits a marked script's output at each LINE_MARK into what every line
+// that ran printed.
+[[nodiscard]] std::vector<std::string>
+split_lines(std::string_view text) {
+  auto out = std::vector<std::string>{};
+
+  for (auto at = text.find(LINE_MARK); std::string_view::npos != at;) {
+    text.remove_prefix(at + LINE_MARK.size());
+    at = text.find(LINE_MARK);
+    out.emplace_back(text.substr(0, at));
+  }
+
+  return out;
+}
+} // namespace
+
+Option<std::vector<std::string>>
+split_simple(std::string_view cmd) {
+  if (!std::ranges::all_of(cmd,
+                           [](char c) { return is_plain(c) || is_blank(c); })) {
+    return {};
+  }
+
+  auto argv = std::vector<std::string>{};
+  auto it = cmd.begin();
+
+  while (cmd.end() != it) {
+    it = std::find_if_not(it, cmd.end(), is_blank);
+    const auto end = std::find_if(it, cmd.end(), is_blank);
+
+    if (it != end) {
+      argv.emplace_back(it, end);
+    }
+
+    it = end;
+  }
+
+  if (argv.empty()) {
+    return {};
+  }
+
+  // `FOO=bar cc ...' sets a variable for the command.
+  const auto &program = argv.front();
+  if (std::string::npos != program.find('=') ||
+      std::ranges::find(SHELL_WORDS, program) != SHELL_WORDS.end()) {
+    return {};
+  }
+
+  return argv;
+}
+
+int
+spawn_direct(const std::vector<std::string> &argv, std::string *output) {
+  auto ptrs = std::vector<char *>{};
+  ptrs.reserve(argv.size() + 1);
+
+  for (const auto &arg : argv) {
+    ptrs.push_back(const_cast<char *>(arg.c_str()));
+  }
+  ptrs.push_back(nullptr);
+
+  try {
+    return spawn(ptrs.front(), ptrs.data(), output);
+  } catch (const std::system_error &exn) {
+    // Unlike execvp(3), posix_spawnp() doesn't hand a file with no `#!' line
+    // to sh(1); system(3) ran those, so the shell still does.
+    if (std::errc::executable_format_error != exn.code()) {
+      throw;
+    }
+  }
+
+  auto cmd = std::string{};
+  for (const auto &arg : argv) {
+    cmd += quote(arg) + " ";
+  }
+
+  return spawn_shell(cmd, output);
+}
+
+int
+spawn_shell(std::string_view cmd, std::string *output) {
+  auto script = std::string{cmd.cbegin(), cmd.cend()};
+  auto argv = std::array<char *, 4>{const_cast<char *>("sh"),
+                                    const_cast<char *>("-c"), script.data(),
+                                    nullptr};
+  return spawn("/bin/sh", argv.data(), output);
+}
+
+std::vector<int>
+run_script(const std::vector<std::string_view> &cmds,
+           std::vector<std::string> *outputs) {
+  auto reported = std::string{};
+  auto printed = std::string{};
+  auto child = Child{};
+  child.capture({SCRIPT_STATUS_FD}, reported);
+  if (outputs) {
+    child.capture({STDOUT_FILENO, STDERR_FILENO}, printed);
+  }
+
+  auto script = make_script(cmds, nullptr != outputs);
+  auto argv = std::array<char *, 4>{const_cast<char *>("sh"),
+                                    const_cast<char *>("-c"), script.data(),
+                                    nullptr};
+
+  const auto pid = child.start("/bin/sh", argv.data());
+  if (pid) {
+    child.drain();
+  }
+
+  const auto status = pid ? wait_for(pid.value()) : CMD_NOT_FOUND;
+
+  auto statuses = std::vector<int>{};
+  auto in = std::istringstream{reported};
+  for (auto s = int{}; in >> s;) {
+    statuses.push_back(s);
+  }
+
+  // A line that exits the shell itself never gets to report its status.
+  if (statuses.size() < cmds.size() &&
+      (statuses.empty() || 0 == statuses.back())) {
+    const auto last = statuses.size() + 1 == cmds.size();
+    statuses.push_back(0 != status || last ? status : SCRIPT_CUT_SHORT);
+  }
+
+  if (outputs) {
+    *outputs = split_lines(printed);
+    // Nothing ran -- the shell couldn't be found -- but it said why.
+    if (outputs->empty() && !statuses.empty()) {
+      outputs->push_back(printed);
+    }
+  }
+
+  return statuses;
+}
+
+int
+run_command(std::string_view cmd, std::string *output) {
+  if (const auto argv = split_simple(cmd)) {
+    return spawn_direct(argv.value(), output);
+  }
+
+  return spawn_shell(cmd, output);
+}
@@ -0,0 +1,57 @@
+#ifndef EXEC_H
+#define EXEC_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "fab.h"
+
+// Exit status reported for a command whose program couldn't be found; matches
+// what sh(1) reports.
+constexpr int CMD_NOT_FOUND = 127;
+
+// Splits `cmd' into an argument vector when running it needs nothing a shell
+// provides: no quoting, expansion, redirection, globbing, builtins or
+// variable assignments. Returns NONE if `cmd' has to go through sh(1).
+Option<std::vector<std::string>> split_simple(std::string_view cmd);
+
+// Each of the functions below that takes `output', given one, collects what
+// the command writes to its stdout and stderr there instead of letting it
+// through. Both go through one pipe, so the two stay interleaved exactly as
+// they were written.
+
+// Runs `argv' without a shell, searching PATH for argv[0]. A file the kernel
+// can't run itself, like a script with no `#!' line, is left to sh(1), as
+// execvp(3) would.
+int spawn_direct(const std::vector<std::string> &argv,
+                 std::string *output = nullptr);
+
+// Runs `cmd' with `/bin/sh -c'.
+int spawn_shell(std::string_view cmd, std::string *output = nullptr);
+
+// The descriptor run_script() hands the shell for reporting exit statuses.
+// Actions in a script shouldn't use it themselves.
+constexpr int SCRIPT_STATUS_FD = 9;
+
+// run_script()'s status for a line that ended the shell, successfully, while
+// there were lines left to run. No real exit status is negative.
+constexpr int SCRIPT_CUT_SHORT = -1;
+
+// Runs every line of `cmds' in one `/bin/sh' process, in order, stopping at
+// the first line that fails -- much like `set -e'. Each line is echoed to
+// stderr as it starts. Returns the exit status of every line that ran. A line
+// that exits the shell fails with its exit status, or SCRIPT_CUT_SHORT if that
+// was 0 and it wasn't the last line: one shell per line would have gone on.
+//
+// Given `outputs', nothing is echoed; instead it's filled with what each line
+// that ran wrote to stdout and stderr, captured as above.
+std::vector<int> run_script(const std::vector<std::string_view> &cmds,
+                            std::vector<std::string> *outputs = nullptr);
+
+// Runs `cmd' directly when it's simple enough to, and through sh(1)
+// otherwise. Returns the command's exit status, or 128 plus the signal number
+// if it was killed by a signal.
+int run_command(std::string_view cmd, std::string *output = nullptr);
+
+#endif // EXEC_H
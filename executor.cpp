@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <cassert>
+#include <iomanip>
+#include <iterator>
+#include <limits>
+#include <ratio>
+#include <utility>
+
+#include "executor.h"
+
+namespace {
+// Identifies the pool -- and the worker within it -- that the calling thread
+// belongs to, so that spawn() can keep new work local.
+thread_local const Executor *tl_owner = nullptr;
+thread_local std::size_t tl_index = 0;
+
+// The order of a worker's heap.
+constexpr auto BY_KEY = [](const auto &a, const auto &b) {
+  return a.key < b.key;
+};
+
+// What a worker advertises as its top priority.
+template <typename Entry>
+[[nodiscard]] std::uint64_t
+top_of(const std::vector<Entry> &heap) {
+  if (heap.empty()) {
+    return 0;
+  }
+
+  const auto priority = heap.front().key.first;
+  return std::numeric_limits<std::uint64_t>::max() == priority ? priority
+                                                                : priority + 1;
+}
+} // namespace
+
+Executor::Executor(unsigned workers) {
+  assert(0 < workers);
+
+  for (unsigned i = 0; i < workers; ++i) {
+    m_workers.push_back(std::make_unique<Worker>());
+  }
+
+  for (unsigned i = 0; i < workers; ++i) {
+    m_threads.emplace_back([this, i] { run(i); });
+  }
+}
+
+Executor::~Executor() {
+  {
+    const auto lock = std::scoped_lock{m_lock};
+    m_stop = true;
+  }
+
+  m_work.notify_all();
+  m_threads.clear();
+}
+
+void
+Executor::push(std::size_t worker, Task task, std::uint64_t priority) {
+  auto &w = *m_workers[worker];
+
+  {
+    const auto lock = std::scoped_lock{w.lock};
+    w.tasks.push_back(Entry{Key{priority, w.queued++}, std::move(task)});
+    std::ranges::push_heap(w.tasks, BY_KEY);
+    w.top.store(top_of(w.tasks));
+    w.stats.max_depth = std::max(w.stats.max_depth, w.tasks.size());
+  }
+
+  m_queued.fetch_add(1);
+
+  if (0 < m_sleepers.load()) {
+    const auto lock = std::scoped_lock{m_lock};
+    m_work.notify_one();
+  }
+}
+
+bool
+Executor::take(std::size_t self, Task &task) {
+  // Ties go to the worker's own queue.
+  auto best = self;
+  auto best_top = m_workers[self]->top.load();
+  for (std::size_t i = 1; i < m_workers.size(); ++i) {
+    const auto other = (self + i) % m_workers.size();
+    if (const auto top = m_workers[other]->top.load(); best_top < top) {
+      best = other;
+      best_top = top;
+    }
+  }
+
+  if (0 == best_top) {
+    return false;
+  }
+
+  return self == best ? pop(self, task) : steal(self, best, task);
+}
+
+bool
+Executor::pop(std::size_t self, Task &task) {
+  auto &w = *m_workers[self];
+  const auto lock = std::scoped_lock{w.lock};
+
+  if (w.tasks.empty()) {
+    return false;
+  }
+
+  std::ranges::pop_heap(w.tasks, BY_KEY);
+  task = std::move(w.tasks.back().task);
+  w.tasks.pop_back();
+  w.top.store(top_of(w.tasks));
+  m_queued.fetch_sub(1);
+  return true;
+}
+
+bool
+Executor::steal(std::size_t self, std::size_t victim, Task &task) {
+  {
+    auto &v = *m_workers[victim];
+    const auto lock = std::scoped_lock{v.lock};
+    if (v.tasks.empty()) {
+      return false;
+    }
+
+    // Steals are rare enough that finding the oldest of the highest, and
+    // rebuilding the heap without it, can take a pass over the whole queue.
+    const auto top = v.tasks.front().key.first;
+    auto oldest = v.tasks.begin();
+    for (auto it = v.tasks.begin(); it != v.tasks.end(); ++it) {
+      if (top == it->key.first && it->key < oldest->key) {
+        oldest = it;
+      }
+    }
+
+    task = std::move(oldest->task);
+    *oldest = std::move(v.tasks.back());
+    v.tasks.pop_back();
+    std::ranges::make_heap(v.tasks, BY_KEY);
+    v.top.store(top_of(v.tasks));
+    m_queued.fetch_sub(1);
+  }
+
+  // Only once the victim is unlocked: two workers stealing from each other
+  // would otherwise each hold the lock the other is waiting for.
+  auto &w = *m_workers[self];
+  const auto lock = std::scoped_lock{w.lock};
+  ++w.stats.steals;
+  return true;
+}
+
+void
+Executor::run(std::size_t self) {
+  tl_owner = this;
+  tl_index = self;
+
+  auto &w = *m_workers[self];
+  auto task = Task{};
+
+  while (true) {
+    if (take(self, task)) {
+      task();
+      task = nullptr;
+
+      {
+        const auto lock = std::scoped_lock{w.lock};
+        ++w.stats.tasks;
+      }
+
+      if (1 == m_outstanding.fetch_sub(1)) {
+        const auto lock = std::scoped_lock{m_lock};
+        m_done.notify_all();
+      }
+
+      continue;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    {
+      auto lock = std::unique_lock{m_lock};
+      m_sleepers.fetch_add(1);
+      m_work.wait(lock, [this] { return m_stop || 0 < m_queued.load(); });
+      m_sleepers.fetch_sub(1);
+
+      if (m_stop) {
+        return;
+      }
+    }
+
+    const auto idle = std::chrono::steady_clock::now() - start;
+    const auto lock = std::scoped_lock{w.lock};
+    w.stats.idle += idle;
+  }
+}
+
+void
+Executor::spawn(Task task, std::uint64_t priority) {
+  m_outstanding.fetch_add(1);
+
+  const auto worker =
+      this == tl_owner ? tl_index : m_next.fetch_add(1) % m_workers.size();
+  push(worker, std::move(task), priority);
+}
+
+void
+Executor::wait() {
+  auto lock = std::unique_lock{m_lock};
+  m_done.wait(lock, [this] { return 0 == m_outstanding.load(); });
+}
+
+std::vector<WorkerStats>
+Executor::stats() const {
+  auto out = std::vector<WorkerStats>{};
+
+  for (const auto &w : m_workers) {
+    const auto lock = std::scoped_lock{w->lock};
+    out.push_back(w->stats);
+  }
+
+  return out;
+}
+
+std::ostream &
+operator<<(std::ostream &os, const std::vector<WorkerStats> &stats) {
+  const auto ms = [](std::chrono::nanoseconds ns) {
+    return std::chrono::duration<double, std::milli>(ns).count();
+  };
+
+  auto total = WorkerStats{};
+  for (const auto &s : stats) {
+    total.tasks += s.tasks;
+    total.steals += s.steals;
+    total.max_depth = std::max(total.max_depth, s.max_depth);
+    total.idle += s.idle;
+  }
+
+  os << std::fixed << std::setprecision(3);
+  os << "scheduler: " << stats.size() << " workers, " << total.tasks
+     << " tasks, " << total.steals << " steals, max queue depth "
+     << total.max_depth << ", idle " << ms(total.idle) << "ms\n";
+
+  for (std::size_t i = 0; i < stats.size(); ++i) {
+    const auto &s = stats[i];
+    os << "  worker " << i << ": " << s.tasks << " tasks, " << s.steals
+       << " steals, max queue depth " << s.max_depth << ", idle "
+       << ms(s.idle) << "ms\n";
+  }
+
+  return os;
+}
@@ -0,0 +1,97 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A snapshot of one worker's counters. `idle' covers the time the worker spent
+// with nothing to pop or steal.
+struct WorkerStats {
+  std::uint64_t tasks = 0;
+  std::uint64_t steals = 0;
+  std::size_t max_depth = 0;
+  std::chrono::nanoseconds idle = {};
+};
+
+// A fixed pool of threads that each own a queue of tasks. A worker puts the
+// tasks it spawns on its own queue. Whenever it's ready for another, it takes
+// the highest-priority task queued anywhere: its own if none is higher, and
+// the newest among equals, so a dependent usually runs on the thread that
+// just produced its inputs. Otherwise it steals from the worker that has the
+// higher one, taking the oldest among equals. Tasks must not throw.
+class Executor {
+public:
+  using Task = std::function<void()>;
+
+private:
+  // Priority, then the order tasks were queued in.
+  using Key = std::pair<std::uint64_t, std::uint64_t>;
+
+  struct Entry {
+    Key key;
+    Task task;
+  };
+
+  struct Worker {
+    std::mutex lock = {};
+    // A max-heap on `key', kept in a vector so queueing rarely allocates.
+    std::vector<Entry> tasks = {};
+    std::uint64_t queued = 0;
+    // One more than the priority at the top of `tasks', or 0 when it's empty;
+    // read by other workers without taking `lock'.
+    std::atomic<std::uint64_t> top = 0;
+    WorkerStats stats = {};
+  };
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  std::vector<std::jthread> m_threads = {};
+
+  // Tasks that have been spawned but haven't finished running.
+  std::atomic<std::size_t> m_outstanding = 0;
+  // Tasks sitting in some deque.
+  std::atomic<std::size_t> m_queued = 0;
+  std::atomic<std::size_t> m_sleepers = 0;
+  std::atomic<std::size_t> m_next = 0;
+  bool m_stop = false;
+  std::mutex m_lock = {};
+  std::condition_variable m_work = {};
+  std::condition_variable m_done = {};
+
+  bool take(std::size_t self, Task &task);
+  bool pop(std::size_t self, Task &task);
+  bool steal(std::size_t self, std::size_t victim, Task &task);
+  void push(std::size_t worker, Task task, std::uint64_t priority);
+  void run(std::size_t self);
+
+public:
+  explicit Executor(unsigned workers);
+  ~Executor();
+
+  Executor(const Executor &) = delete;
+  Executor &operator=(const Executor &) = delete;
+
+  // Queues `task'. Called from a worker, the task goes onto that worker's own
+  // queue; otherwise tasks are dealt to the workers in turn. Higher priorities
+  // run first.
+  void spawn(Task task, std::uint64_t priority = 0);
+
+  // Blocks until every spawned task -- including tasks spawned by tasks -- has
+  // finished.
+  void wait();
+
+  [[nodiscard]] std::vector<WorkerStats> stats() const;
+};
+
+std::ostream &operator<<(std::ostream &os, const std::vector<WorkerStats> &s);
+
+#endif // EXECUTOR_H
@@ -4,17 +4,27 @@
 #include <concepts>
 #include <cstdlib>
 #include <functional>
+#include <limits>
 #include <map>
 #include <ranges>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include <variant>
 #include <vector>
 
+#include "dircache.h"
 #include "fab.h"
+#include "scan.h"
+#include "trace.h"
 
 namespace {
+// Whitespace between tokens.
+constexpr auto BLANKS = scan::Space | scan::Tab | scan::Newline;
+
 template <typename T>
 [[nodiscard]] constexpr bool
 same_as_v() {
@@ -65,24 +75,35 @@ concept Concat = requires(S s) {
   {std::string{}.append(s)};
 };
 
+// Appends the elements of `range' to `out', separated by `delim'. Handy for
+// reusing one buffer across many folds.
 template <typename R, typename D, typename Transform = std::identity>
 requires std::ranges::range<R> &&
     std::invocable<Transform, std::ranges::range_value_t<R>> &&
     Concat<std::invoke_result_t<Transform, std::ranges::range_value_t<R>>>
-[[nodiscard]] std::string
-foldl(R &&range, const D &delim, Transform transform = {}) {
-  auto s = std::string{};
+void
+foldl_into(std::string &out, R &&range, const D &delim,
+           Transform transform = {}) {
   auto first = bool{true};
 
   for (const auto &e : range) {
     if (!first) {
-      s += delim;
+      out += delim;
     }
 
-    s += std::invoke(transform, e);
+    out += std::invoke(transform, e);
     first = false;
   }
+}
 
+template <typename R, typename D, typename Transform = std::identity>
+requires std::ranges::range<R> &&
+    std::invocable<Transform, std::ranges::range_value_t<R>> &&
+    Concat<std::invoke_result_t<Transform, std::ranges::range_value_t<R>>>
+[[nodiscard]] std::string
+foldl(R &&range, const D &delim, Transform transform = {}) {
+  auto s = std::string{};
+  foldl_into(s, range, delim, transform);
   return s;
 }
 } // namespace
@@ -119,6 +140,10 @@ struct [[nodiscard]] FabError final : std::runtime_error {
 
   struct [[nodiscard]] NoRulesToRun {};
 
+  struct [[nodiscard]] RecursiveMacro {
+    const std::string_view macro;
+  };
+
   struct [[nodiscard]] UndefinedGenericRule {
     const std::string_view target;
     const std::string_view prereq;
@@ -173,6 +198,10 @@ struct [[nodiscard]] FabError final : std::runtime_error {
       return "no rules to run.";
     }
 
+    [[nodiscard]] std::string operator()(const RecursiveMacro &r) const {
+      return "recursive macro: " + sv_to_string(r.macro);
+    }
+
     [[nodiscard]] std::string operator()(const UndefinedGenericRule &g) {
       return "undefined generic rule: {target = " + sv_to_string(g.target) +
              ", prereq = " + sv_to_string(g.prereq) + "}.";
@@ -181,9 +210,10 @@ struct [[nodiscard]] FabError final : std::runtime_error {
 
   using ErrTy =
       std::variant<BuiltInMacrosRequireActionScope, ExpectedLValue,
-                   NoRulesToRun, TokenNotInExpectedSet, UndefinedGenericRule,
-                   UndefinedVariable, UnexpectedCharacter, UnexpectedEof,
-                   UnexpectedFill, UnexpectedTokenType, UnknownTarget>;
+                   NoRulesToRun, RecursiveMacro, TokenNotInExpectedSet,
+                   UndefinedGenericRule, UndefinedVariable, UnexpectedCharacter,
+                   UnexpectedEof, UnexpectedFill, UnexpectedTokenType,
+                   UnknownTarget>;
 
   explicit FabError(const ErrTy &ty)
       : std::runtime_error(std::visit(GetErrMsg{}, ty)) {
@@ -217,7 +247,7 @@ using ValueType = std::variant<LValue, RValue, TargetAlias, PrereqAlias>;
 // resolved some point later on in parsing.
 using Association = std::tuple<std::string_view, std::vector<ValueType>>;
 
-using Binding = std::pair<std::string_view, std::string>;
+using Macros = std::map<std::string_view, std::string_view>;
 
 // Intermediate representation for Rules -- after parsing they'll need to be
 // resolved by looking each `ValueType` variant up in the environment.
@@ -258,24 +288,32 @@ struct [[nodiscard]] GenericRule {
   const std::vector<std::vector<ValueType>> actions;
 };
 
-bool
-operator==(const GenericRule &lhs, const Fill &rhs) {
-  return std::tie(lhs.target_ext, lhs.prereq_ext) ==
-         std::tie(rhs.target_ext, rhs.prereq_ext);
-}
+// Hashes a generic rule's (target, prereq) extensions.
+struct [[nodiscard]] ExtensionsHash {
+  [[nodiscard]] std::size_t
+  operator()(const std::pair<std::string_view, std::string_view> &e) const {
+    const auto h = std::hash<std::string_view>{};
+    return h(e.first) * 31 + h(e.second);
+  }
+};
 
 struct [[nodiscard]] Ir {
   const std::vector<RuleIr> rules;
   const std::vector<Association> associations;
+  const std::vector<GenericRule> generic_rules;
 };
 
 class [[nodiscard]] LexState {
   const std::string_view buf;
-  std::string_view::const_iterator m_offset = buf.cbegin();
+  std::string_view::const_iterator m_offset;
+  scan::Classifier &m_classes;
 
 public:
-  LexState(std::string_view source)
-      : buf(source) {
+  LexState(std::string_view source, std::size_t offset,
+           scan::Classifier &classes)
+      : buf(source)
+      , m_offset(std::next(buf.cbegin(), static_cast<std::ptrdiff_t>(offset)))
+      , m_classes(classes) {
   }
 
   [[nodiscard]] char next() {
@@ -292,6 +330,10 @@ public:
     return buf.cend() == m_offset;
   }
 
+  [[nodiscard]] std::size_t offset() const {
+    return static_cast<std::size_t>(std::distance(buf.cbegin(), m_offset));
+  }
+
   void eat(char expected) {
     if (expected != *m_offset) {
       throw FabError(FabError::UnexpectedCharacter{.expected = expected,
@@ -315,45 +357,94 @@ public:
     return std::string_view{begin, end};
   }
 
-  template <typename P>
-  [[nodiscard]] auto eat_until(P pred) requires std::predicate<P, char> {
+  // Stops in front of the first byte in one of the `stops' classes. Running
+  // out of input first is an error.
+  [[nodiscard]] auto eat_until_any(unsigned stops) {
     const auto begin = m_offset;
+    const auto end = m_classes.find(offset(), stops);
 
-    while (!pred(next()))
-      ;
-
-    assert(m_offset != buf.begin());
-    m_offset = std::prev(m_offset);
+    if (buf.size() == end) {
+      throw FabError(FabError::UnexpectedEof{});
+    }
 
+    m_offset = std::next(buf.cbegin(), static_cast<std::ptrdiff_t>(end));
     return std::tuple{begin, m_offset};
   }
+
+  // Steps over any run of bytes in `skipped'.
+  void skip_any(unsigned skipped) {
+    m_offset = std::next(buf.cbegin(), static_cast<std::ptrdiff_t>(
+                                           m_classes.skip(offset(), skipped)));
+  }
+};
+
+// Anything the parser can pull tokens from, one at a time. A source must keep
+// returning Eof once it runs out.
+template <typename S>
+concept TokenSource = requires(S s) {
+  { s.next() } -> std::same_as<Token>;
+};
+
+// Replays tokens that were lexed up front.
+class [[nodiscard]] TokenVector {
+  std::vector<Token> m_tokens;
+  std::size_t m_next = 0;
+
+public:
+  explicit TokenVector(std::vector<Token> &&tokens)
+      : m_tokens(std::move(tokens)) {
+    assert(!m_tokens.empty() && Token::Ty::Eof == m_tokens.back().ty());
+  }
+
+  [[nodiscard]] Token next() {
+    return m_tokens[std::min(m_next++, m_tokens.size() - 1)];
+  }
+};
+
+// Walks a packed stream.
+class [[nodiscard]] StreamCursor {
+  const TokenStream &m_tokens;
+  std::size_t m_next = 0;
+
+public:
+  explicit StreamCursor(const TokenStream &tokens)
+      : m_tokens(tokens) {
+    assert(0 < m_tokens.size());
+  }
+
+  [[nodiscard]] Token next() {
+    return m_tokens[std::min(m_next++, m_tokens.size() - 1)];
+  }
 };
 
+// The grammar only ever needs to look one token ahead, so that's all the
+// parser holds on to.
+template <TokenSource S>
 class [[nodiscard]] ParseState {
-  const std::vector<Token> tokens;
-  std::vector<Token>::const_iterator m_offset = tokens.cbegin();
+  S m_source;
+  Option<Token> m_current;
   std::vector<Association> m_associations = {};
   std::vector<Fill> m_fills = {};
   std::vector<RuleIr> m_rules = {};
   std::vector<GenericRule> m_generic_rules = {};
 
 private:
-  const Token &eat(Token::Ty expected) {
-    assert(m_offset != tokens.end());
-    const auto &actual = *m_offset;
+  Token eat(Token::Ty expected) {
+    assert(m_current.has_value());
+    const auto actual = *m_current;
 
     if (expected != actual.ty()) {
       throw FabError(FabError::UnexpectedTokenType{.expected = expected,
                                                    .actual = actual.ty()});
     }
 
-    m_offset = std::next(m_offset);
+    m_current.emplace(m_source.next());
     return actual;
   }
 
   template <Token::Ty ty>
   [[nodiscard]] std::string_view eat_for_lexeme() {
-    return eat(ty).lexeme<ty>();
+    return eat(ty).template lexeme<ty>();
   }
 
   [[nodiscard]] std::tuple<std::vector<ValueType>,
@@ -380,7 +471,7 @@ private:
       throw FabError(FabError::UnexpectedEof{});
       return {};
     } else {
-      return m_offset->ty();
+      return m_current->ty();
     }
   }
 
@@ -477,8 +568,9 @@ private:
   }
 
 public:
-  ParseState(std::vector<Token> &&tokens)
-      : tokens(tokens) {
+  explicit ParseState(S source)
+      : m_source(std::move(source))
+      , m_current(m_source.next()) {
   }
 
   void stmt_list() {
@@ -516,16 +608,23 @@ public:
   }
 
   [[nodiscard]] bool eof() const {
-    assert(m_offset != tokens.cend());
-    return Token::Ty::Eof == m_offset->ty();
+    assert(m_current.has_value());
+    return Token::Ty::Eof == m_current->ty();
   }
 
   [[nodiscard]] Ir into_ir() && {
+    // The first generic rule for a pair of extensions wins.
+    auto index =
+        std::unordered_map<std::pair<std::string_view, std::string_view>,
+                           const GenericRule *, ExtensionsHash>{};
+    for (const auto &g : m_generic_rules) {
+      index.try_emplace({g.target_ext, g.prereq_ext}, &g);
+    }
+
     for (const auto &fill : m_fills) {
-      const auto matching =
-          std::find(m_generic_rules.cbegin(), m_generic_rules.cend(), fill);
+      const auto matching = index.find({fill.target_ext, fill.prereq_ext});
 
-      if (m_generic_rules.cend() == matching) {
+      if (index.end() == matching) {
         throw FabError(FabError::UndefinedGenericRule{.target = fill.target,
                                                       .prereq = fill.prereq});
       } else {
@@ -533,13 +632,14 @@ public:
             .target = detail::RValue{.iden = fill.target},
             .prereqs = std::vector<detail::ValueType>{detail::RValue{
                 .iden = fill.prereq}},
-            .actions = matching->actions});
+            .actions = matching->second->actions});
       }
     }
 
     return Ir{
         .rules = std::move(m_rules),
         .associations = std::move(m_associations),
+        .generic_rules = std::move(m_generic_rules),
     };
   }
 };
@@ -560,7 +660,7 @@ template <typename T>
 concept FileScope = SameAs<T, RValue, LValue>;
 
 struct [[nodiscard]] Resolver {
-  const std::map<std::string_view, std::string> &macros;
+  const Macros &macros;
 
   [[nodiscard]] std::string_view operator()(const RValue &term) const {
     return term.iden;
@@ -584,71 +684,135 @@ struct [[nodiscard]] Resolver {
 struct [[nodiscard]] ActionResolver {
   const std::string_view target;
   const std::vector<std::string_view> prereqs;
-  const std::map<std::string_view, std::string> &macros;
+  const Macros &macros;
+  Arena &strings;
 
-  [[nodiscard]] std::string operator()(const TargetAlias &) const {
-    return sv_to_string(target);
+  [[nodiscard]] std::string_view operator()(const TargetAlias &) const {
+    return target;
   }
 
-  [[nodiscard]] std::string operator()(const PrereqAlias &) const {
-    return foldl(prereqs, " ");
+  [[nodiscard]] std::string_view operator()(const PrereqAlias &) const {
+    return strings.intern(foldl(prereqs, " "));
   }
 
   template <typename T>
-  [[nodiscard]] std::string
+  [[nodiscard]] std::string_view
   operator()(const T &variant) const requires FileScope<T> {
-    return sv_to_string(Resolver{macros}(variant));
+    return Resolver{macros}(variant);
   }
 };
 
 namespace detail {
-[[nodiscard]] Binding
-resolve_rvalue(const Association &association) {
-  const auto into_rvalue = [](const ValueType &v) {
-    return std::get<RValue>(v).iden;
+// Every macro a rule or generic rule refers to, in order of first use.
+[[nodiscard]] std::vector<std::string_view>
+used_macros(const Ir &ir) {
+  auto seen = std::unordered_set<std::string_view>{};
+  auto used = std::vector<std::string_view>{};
+  const auto use = [&](const ValueType &v) {
+    if (const auto *lvalue = std::get_if<LValue>(&v);
+        lvalue && seen.insert(lvalue->iden).second) {
+      used.push_back(lvalue->iden);
+    }
   };
 
-  const auto [iden, values] = association;
-  return std::make_pair(iden, foldl(values, " ", into_rvalue));
+  for (const auto &rule : ir.rules) {
+    use(rule.target);
+    std::ranges::for_each(rule.prereqs, use);
+    for (const auto &action : rule.actions) {
+      std::ranges::for_each(action, use);
+    }
+  }
+
+  for (const auto &g : ir.generic_rules) {
+    for (const auto &action : g.actions) {
+      std::ranges::for_each(action, use);
+    }
+  }
+
+  return used;
 }
 
-struct [[nodiscard]] NonRValueResolver {
-  const std::map<std::string_view, std::string> &macros;
+// Resolves the macros in `roots' along with every macro they refer to, each
+// one only after the macros it refers to. A macro is expanded once no matter
+// how many others use it, and one that nothing in `roots' reaches is never
+// expanded at all. The first definition of a macro wins.
+[[nodiscard]] Macros
+resolve_associations(const std::vector<Association> &associations,
+                     const std::vector<std::string_view> &roots,
+                     Arena &strings) {
+  auto definitions =
+      std::unordered_map<std::string_view, const std::vector<ValueType> *>{};
+  for (const auto &[iden, values] : associations) {
+    // Checked up front: it's an error whether or not the macro is used.
+    if (std::ranges::any_of(values, [](const ValueType &v) {
+          return std::holds_alternative<TargetAlias>(v) ||
+                 std::holds_alternative<PrereqAlias>(v);
+        })) {
+      throw FabError(FabError::BuiltInMacrosRequireActionScope{});
+    }
 
-  [[nodiscard]] Binding operator()(const Association &association) const {
-    const auto resolver = Resolver{.macros = macros};
-    const auto [iden, values] = association;
-    return std::make_pair(iden, foldl(values, " ", [&](const ValueType &value) {
-                            return std::visit(resolver, value);
-                          }));
+    definitions.emplace(iden, &values);
   }
-};
 
-[[nodiscard]] std::map<std::string_view, std::string>
-resolve_associations(const std::vector<Association> &associations) {
-  const auto is_rvalue = [](const Association &association) {
-    const auto [iden, values] = association;
-    return std::ranges::all_of(values, [](const auto &v) {
-      return std::holds_alternative<RValue>(v);
-    });
-  };
+  auto macros = Macros{};
+  const auto resolver = Resolver{.macros = macros};
+
+  // A macro is `open' from when its references are pushed until it's
+  // expanded; everything above it on the stack is something it refers to, so
+  // reaching it again means it refers to itself.
+  auto open = std::unordered_set<std::string_view>{};
+  auto stack = std::vector<std::string_view>{};
+  auto scratch = std::string{};
+
+  for (auto root : roots) {
+    stack.push_back(root);
+
+    while (!stack.empty()) {
+      const auto iden = stack.back();
+
+      if (macros.contains(iden)) {
+        stack.pop_back();
+        continue;
+      }
 
-  auto rvalues = std::views::filter(associations, is_rvalue);
-  auto non_rvalues = std::views::filter(associations, std::not_fn(is_rvalue));
+      const auto *values =
+          find_or_throw(definitions, iden, [iden] {
+            return FabError(FabError::UndefinedVariable{.var = iden});
+          }).second;
 
-  auto macros = std::map<std::string_view, std::string>{};
-  std::ranges::move(std::views::transform(rvalues, resolve_rvalue),
-                    std::inserter(macros, macros.begin()));
-  std::ranges::move(
-      std::views::transform(non_rvalues, NonRValueResolver{.macros = macros}),
-      std::inserter(macros, macros.begin()));
+      if (open.insert(iden).second) {
+        for (const auto &v : *values) {
+          const auto *lvalue = std::get_if<LValue>(&v);
+          if (!lvalue || macros.contains(lvalue->iden)) {
+            continue;
+          }
+
+          if (open.contains(lvalue->iden)) {
+            throw FabError(FabError::RecursiveMacro{.macro = lvalue->iden});
+          }
+
+          stack.push_back(lvalue->iden);
+        }
+
+        continue;
+      }
+
+      scratch.clear();
+      foldl_into(scratch, *values, " ",
+                 [&](const ValueType &v) { return std::visit(resolver, v); });
+      macros.emplace(iden, strings.intern(scratch));
+      open.erase(iden);
+      stack.pop_back();
+    }
+  }
 
   return macros;
 }
 
+// `scratch' is only used to build each action before it's interned.
 [[nodiscard]] Rule
-resolve_rule(const std::map<std::string_view, std::string> &macros,
-             const RuleIr &rule) {
+resolve_rule(const Macros &macros, const RuleIr &rule, Arena &strings,
+             std::string &scratch) {
   const auto resolver = Resolver{.macros = macros};
   const auto target = std::visit(resolver, rule.target);
   auto prereqs =
@@ -656,15 +820,19 @@ resolve_rule(const std::map<std::string_view, std::string> &macros,
         return std::visit(resolver, v);
       }));
 
+  const auto action_resolver = ActionResolver{.target = target,
+                                              .prereqs = prereqs,
+                                              .macros = macros,
+                                              .strings = strings};
   const auto resolve_action = [&](const ValueType &v) {
-    const auto resolver =
-        ActionResolver{.target = target, .prereqs = prereqs, .macros = macros};
-    return std::visit(resolver, v);
+    return std::visit(action_resolver, v);
   };
 
   auto actions =
       move_collect(std::views::transform(rule.actions, [&](const auto &action) {
-        return foldl(action, " ", resolve_action);
+        scratch.clear();
+        foldl_into(scratch, action, " ", resolve_action);
+        return strings.intern(scratch);
       }));
 
   return Rule{.target = target,
@@ -673,13 +841,86 @@ resolve_rule(const std::map<std::string_view, std::string> &macros,
 }
 
 [[nodiscard]] std::vector<Rule>
-resolve_rules(const std::map<std::string_view, std::string> &macros,
-              const std::vector<RuleIr> &rule_irs) {
+resolve_rules(const Macros &macros, const std::vector<RuleIr> &rule_irs,
+              Arena &strings) {
+  auto scratch = std::string{};
   return move_collect(std::views::transform(rule_irs, [&](const RuleIr &rule) {
-    return resolve_rule(macros, rule);
+    return resolve_rule(macros, rule, strings, scratch);
   }));
 }
 
+// Gives make-style implicit rules to prerequisites that no rule builds. A
+// prerequisite gets the first generic rule for its extension whose
+// prerequisite -- the same base name with the rule's other extension -- is
+// either built by a rule or is a file. Existence checks go through `dirs'.
+// Newly inferred prerequisites are considered in turn, so rules chain.
+void
+infer_rules(const Macros &macros, const std::vector<GenericRule> &generic_rules,
+            std::vector<Rule> &rules, Arena &strings, DirCache &dirs) {
+  auto by_ext = std::unordered_map<std::string_view,
+                                   std::vector<const GenericRule *>>{};
+  for (const auto &g : generic_rules) {
+    // One without a prerequisite would claim every file with its extension.
+    if (!g.prereq_ext.empty()) {
+      by_ext[g.target_ext].push_back(&g);
+    }
+  }
+
+  if (by_ext.empty()) {
+    return;
+  }
+
+  auto targets = std::unordered_set<std::string_view>{};
+  auto pending = std::vector<std::string_view>{};
+  for (const auto &rule : rules) {
+    targets.insert(rule.target);
+    pending.insert(pending.end(), rule.prereqs.begin(), rule.prereqs.end());
+  }
+
+  auto checked = std::unordered_set<std::string_view>{};
+  auto candidate = std::string{};
+  auto scratch = std::string{};
+
+  while (!pending.empty()) {
+    const auto name = pending.back();
+    pending.pop_back();
+
+    if (targets.contains(name) || !checked.insert(name).second) {
+      continue;
+    }
+
+    const auto dot = name.rfind('.');
+    if (std::string_view::npos == dot || name.find('/', dot) != name.npos) {
+      continue;
+    }
+
+    const auto matching = by_ext.find(name.substr(dot + 1));
+    if (by_ext.end() == matching) {
+      continue;
+    }
+
+    for (const auto *g : matching->second) {
+      candidate.assign(name.substr(0, dot + 1));
+      candidate += g->prereq_ext;
+
+      if (name == candidate ||
+          (!targets.contains(candidate) && !dirs.exists(candidate))) {
+        continue;
+      }
+
+      const auto prereq = strings.intern(candidate);
+      const auto ir =
+          RuleIr{.target = RValue{.iden = name},
+                 .prereqs = std::vector<ValueType>{RValue{.iden = prereq}},
+                 .actions = g->actions};
+      rules.push_back(resolve_rule(macros, ir, strings, scratch));
+      targets.insert(name);
+      pending.push_back(prereq);
+      break;
+    }
+  }
+}
+
 template <typename T>
 [[nodiscard]] std::set<T, std::less<>>
 into_set(std::vector<T> vs) requires std::move_constructible<T> {
@@ -693,19 +934,51 @@ into_set(std::vector<T> vs) requires std::move_constructible<T> {
 
 [[nodiscard]] Environment
 parse_state(Ir ir) {
-  auto macros = detail::resolve_associations(ir.associations);
-  auto rules = detail::resolve_rules(macros, ir.rules);
+  auto strings = Arena{};
+  auto macros = detail::resolve_associations(
+      ir.associations, detail::used_macros(ir), strings);
+  auto rules = detail::resolve_rules(macros, ir.rules, strings);
 
   if (rules.empty()) {
     throw FabError(FabError::NoRulesToRun{});
   }
 
+  auto dirs = DirCache{};
+  detail::infer_rules(macros, ir.generic_rules, rules, strings, dirs);
+
+  auto listings = dirs.listings();
+  for (auto &l : listings) {
+    l.dir = strings.intern(l.dir);
+    for (auto &name : l.names) {
+      name = strings.intern(name);
+    }
+  }
+
   const std::string_view head = rules.front().target;
-  return Environment{.macros = std::move(macros),
+  return Environment{.strings = std::move(strings),
+                     .macros = std::move(macros),
                      .rules = detail::into_set(std::move(rules)),
-                     .head = head};
+                     .head = head,
+                     .listings = std::move(listings)};
 }
 } // namespace resolve
+
+template <TokenSource S>
+[[nodiscard]] Environment
+parse_from(S source) {
+  auto state = ParseState<S>{std::move(source)};
+
+  // Tokens are pulled as the parser needs them, so this covers lexing too.
+  {
+    const auto span = trace::Span{"phase", "parse"};
+    while (!state.eof()) {
+      state.stmt_list();
+    }
+  }
+
+  const auto span = trace::Span{"phase", "resolve"};
+  return resolve::parse_state(std::move(state).into_ir());
+}
 } // namespace detail
 
 Token::Token(Token::Ty ty, Option<std::string_view> lexeme)
@@ -713,104 +986,164 @@ Token::Token(Token::Ty ty, Option<std::string_view> lexeme)
     , m_lexeme(lexeme) {
 }
 
-[[nodiscard]] std::vector<Token>
-lex(std::string_view source) {
-  detail::LexState state{source};
-  auto tokens = std::vector<Token>{};
+Lexer::Lexer(std::string_view source)
+    : m_source(source)
+    , m_classes(source) {
+}
 
-  while (!state.eof()) {
-    switch (state.next()) {
-    case '\t':
-      [[fallthrough]];
-    case '\n':
-      [[fallthrough]];
-    case ' ':
+[[nodiscard]] Token
+Lexer::next() {
+  detail::LexState state{m_source, m_offset, m_classes};
+  auto token = Option<Token>{};
+
+  while (!token && !state.eof()) {
+    state.skip_any(BLANKS);
+    if (state.eof()) {
       break;
+    }
+
+    switch (state.next()) {
     case '#': {
-      [[maybe_unused]] auto dc =
-          state.eat_until([](char c) { return '\n' == c; });
+      [[maybe_unused]] auto dc = state.eat_until_any(scan::Newline);
       state.eat('\n');
       break;
     }
     case ':':
       state.eat('=');
-      tokens.push_back(Token::make<Token::Ty::Eq>());
+      token.emplace(Token::make<Token::Ty::Eq>());
       break;
     case ';':
-      tokens.push_back(Token::make<Token::Ty::SemiColon>());
+      token.emplace(Token::make<Token::Ty::SemiColon>());
       break;
     case '{':
-      tokens.push_back(Token::make<Token::Ty::LBrace>());
+      token.emplace(Token::make<Token::Ty::LBrace>());
       break;
     case '}':
-      tokens.push_back(Token::make<Token::Ty::RBrace>());
+      token.emplace(Token::make<Token::Ty::RBrace>());
       break;
     case '<':
       state.eat('-');
-      tokens.push_back(Token::make<Token::Ty::Arrow>());
+      token.emplace(Token::make<Token::Ty::Arrow>());
       break;
     case '[':
       if ('*' == state.peek()) {
         state.eat('*');
         state.eat('.');
-        const auto [begin, end] =
-            state.eat_until([](char c) { return ']' == c; });
+        const auto [begin, end] = state.eat_until_any(scan::RBracket);
         state.eat(']');
-        tokens.push_back(Token::make<Token::Ty::GenericRule>(
+        token.emplace(Token::make<Token::Ty::GenericRule>(
             state.extract_lexeme(begin, end)));
         break;
       } else {
-        const auto [begin, end] =
-            state.eat_until([](char c) { return ']' == c; });
+        const auto [begin, end] = state.eat_until_any(scan::RBracket);
         state.eat(']');
-        tokens.push_back(
+        token.emplace(
             Token::make<Token::Ty::Fill>(state.extract_lexeme(begin, end)));
         break;
       }
     case '$': {
       if ('@' == state.peek()) {
         state.eat('@');
-        tokens.push_back(Token::make<Token::Ty::TargetAlias>());
+        token.emplace(Token::make<Token::Ty::TargetAlias>());
         break;
       }
 
       if ('<' == state.peek()) {
         state.eat('<');
-        tokens.push_back(Token::make<Token::Ty::PrereqAlias>());
+        token.emplace(Token::make<Token::Ty::PrereqAlias>());
         break;
       }
 
       state.eat('(');
-      const auto [begin, end] =
-          state.eat_until([](char c) { return ')' == c; });
-      tokens.push_back(
+      const auto [begin, end] = state.eat_until_any(scan::RParen);
+      token.emplace(
           Token::make<Token::Ty::Macro>(state.extract_lexeme(begin, end)));
       state.eat(')');
       break;
     }
     default: {
       const auto [begin, end] =
-          state.eat_until([](char c) { return matches(c, ' ', '\n', ';'); });
+          state.eat_until_any(scan::Space | scan::Newline | scan::SemiColon);
 
-      tokens.push_back(Token::make<Token::Ty::Iden>(
+      token.emplace(Token::make<Token::Ty::Iden>(
           state.extract_lexeme(std::prev(begin), end)));
       break;
     }
     }
   }
 
-  tokens.push_back(Token::make<Token::Ty::Eof>());
+  m_offset = state.offset();
+  return token ? *token : Token::make<Token::Ty::Eof>();
+}
+
+[[nodiscard]] std::vector<Token>
+lex(std::string_view source) {
+  auto lexer = Lexer{source};
+  auto tokens = std::vector<Token>{};
+
+  do {
+    tokens.push_back(lexer.next());
+  } while (Token::Ty::Eof != tokens.back().ty());
+
   return tokens;
 }
 
+TokenStream::TokenStream(std::string_view source)
+    : m_source(source) {
+  if (std::numeric_limits<std::uint32_t>::max() < source.size()) {
+    throw std::runtime_error("Fabfile is too large to tokenize.");
+  }
+
+  auto lexer = Lexer{source};
+  while (true) {
+    const auto token = lexer.next();
+    const auto lexeme = token.m_lexeme.value_or(std::string_view{});
+    const auto offset = lexeme.empty() ? 0 : lexeme.data() - source.data();
+
+    m_types.push_back(token.ty());
+    m_offsets.push_back(static_cast<std::uint32_t>(offset));
+    m_lengths.push_back(static_cast<std::uint32_t>(lexeme.size()));
+
+    if (Token::Ty::Eof == token.ty()) {
+      break;
+    }
+  }
+}
+
+std::size_t
+TokenStream::size() const {
+  return m_types.size();
+}
+
+Token::Ty
+TokenStream::ty(std::size_t i) const {
+  return m_types[i];
+}
+
+Token
+TokenStream::operator[](std::size_t i) const {
+  const auto ty = m_types[i];
+  if (matches(ty, Token::Ty::Fill, Token::Ty::Iden, Token::Ty::Macro,
+              Token::Ty::GenericRule)) {
+    return Token{ty, m_source.substr(m_offsets[i], m_lengths[i])};
+  }
+
+  return Token{ty, {}};
+}
+
 [[nodiscard]] Environment
 parse(std::vector<Token> &&tokens) {
-  auto state = detail::ParseState{std::move(tokens)};
-  while (!state.eof()) {
-    state.stmt_list();
-  }
+  return detail::parse_from(detail::TokenVector{std::move(tokens)});
+}
+
+[[nodiscard]] Environment
+parse(Lexer lexer) {
+  return detail::parse_from(std::move(lexer));
+}
 
-  return detail::resolve::parse_state(std::move(state).into_ir());
+[[nodiscard]] Environment
+parse(const TokenStream &tokens) {
+  return detail::parse_from(detail::StreamCursor{tokens});
 }
 
 [[nodiscard]] bool
@@ -828,6 +1161,112 @@ operator<(const Rule &lhs, const Rule &rhs) {
   return lhs.target < rhs.target;
 }
 
+Graph::Graph(const std::set<Rule, std::less<>> &rules) {
+  m_ids.reserve(rules.size());
+  for (const auto &rule : rules) {
+    m_rules[intern(rule.target)] = &rule;
+  }
+
+  // Leaves get their ids after every target's, as they turn up.
+  m_offsets.reserve(rules.size() + 1);
+  m_offsets.push_back(0);
+  for (const auto &rule : rules) {
+    for (auto p : rule.prereqs) {
+      m_edges.push_back(intern(p));
+    }
+
+    m_offsets.push_back(static_cast<std::uint32_t>(m_edges.size()));
+  }
+
+  m_offsets.resize(m_names.size() + 1, m_offsets.back());
+  m_leaves.resize(m_names.size());
+  for (std::size_t id = 0; id < m_names.size(); ++id) {
+    m_leaves[id] = nullptr == m_rules[id];
+  }
+
+  // Count each id's dependents, turn the counts into offsets, then fill the
+  // rows back to front so each ends up in target order.
+  m_dependent_offsets.resize(m_names.size() + 1);
+  for (auto p : m_edges) {
+    ++m_dependent_offsets[p + 1];
+  }
+
+  for (std::size_t id = 0; id < m_names.size(); ++id) {
+    m_dependent_offsets[id + 1] += m_dependent_offsets[id];
+  }
+
+  m_dependents.resize(m_edges.size());
+  auto fill = std::vector<std::uint32_t>(m_dependent_offsets.begin() + 1,
+                                         m_dependent_offsets.end());
+  for (auto id = static_cast<Id>(rules.size()); 0 < id--;) {
+    for (auto p : prereqs(id)) {
+      m_dependents[--fill[p]] = id;
+    }
+  }
+}
+
+Graph::Id
+Graph::intern(std::string_view name) {
+  const auto [it, inserted] =
+      m_ids.try_emplace(name, static_cast<Id>(m_names.size()));
+
+  if (inserted) {
+    m_names.push_back(name);
+    m_rules.push_back(nullptr);
+  }
+
+  return it->second;
+}
+
+std::size_t
+Graph::size() const {
+  return m_names.size();
+}
+
+Option<Graph::Id>
+Graph::find(std::string_view name) const {
+  if (const auto it = m_ids.find(name); m_ids.end() != it) {
+    return it->second;
+  }
+
+  return {};
+}
+
+std::string_view
+Graph::name(Id id) const {
+  return m_names[id];
+}
+
+bool
+Graph::is_leaf(Id id) const {
+  return m_leaves[id];
+}
+
+const Rule &
+Graph::rule(Id id) const {
+  assert(!is_leaf(id));
+  return *m_rules[id];
+}
+
+std::span<const Graph::Id>
+Graph::prereqs(Id id) const {
+  return std::span{m_edges}.subspan(m_offsets[id],
+                                    m_offsets[id + 1] - m_offsets[id]);
+}
+
+std::span<const Graph::Id>
+Graph::dependents(Id id) const {
+  return std::span{m_dependents}.subspan(
+      m_dependent_offsets[id],
+      m_dependent_offsets[id + 1] - m_dependent_offsets[id]);
+}
+
+bool
+Environment::operator==(const Environment &other) const {
+  return std::tie(macros, rules, head) ==
+         std::tie(other.macros, other.rules, other.head);
+}
+
 [[nodiscard]] bool
 Environment::is_leaf(std::string_view rule) const {
   return !rules.contains(rule);
@@ -1,16 +1,28 @@
 #ifndef FAB_H
 #define FAB_H
 
+#include <cassert>
+#include <cstdint>
+#include <map>
 #include <optional>
+#include <ostream>
 #include <set>
+#include <span>
+#include <string>
 #include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "arena.h"
+#include "dircache.h"
+#include "scan.h"
 
 template <typename T>
 using Option = std::optional<T>;
 
 class Token {
 public:
-  enum class Ty {
+  enum class Ty : std::uint8_t {
     // Simple
     Arrow,
     Eof,
@@ -40,6 +52,8 @@ private:
 
   Token(Token::Ty, Option<std::string_view>);
 
+  friend class TokenStream;
+
 public:
   template <Token::Ty ty>
   static Token make(Option<std::string_view> lexeme) {
@@ -72,7 +86,7 @@ public:
 struct Rule {
   const std::string_view target;
   const std::vector<std::string_view> prereqs;
-  const std::vector<std::string> actions;
+  const std::vector<std::string_view> actions;
 
   bool operator==(const Rule &) const = default;
 
@@ -85,21 +99,103 @@ bool operator<(const Rule &lhs, std::string_view rhs);
 bool operator<(std::string_view lhs, const Rule &rhs);
 bool operator<(const Rule &lhs, const Rule &rhs);
 
+// The rules as a graph over dense integer ids, so a traversal indexes arrays
+// instead of comparing strings. Every target and every prerequisite gets an
+// id; an id that no rule builds is a leaf. Edges are stored in compressed
+// sparse row form: the prerequisites of `id' are m_edges[m_offsets[id]] up
+// to m_edges[m_offsets[id + 1]]. The reverse edges are stored the same way.
+//
+// A Graph points into the rules it was built from, so it can't be copied or
+// moved away from them.
+class Graph {
+public:
+  using Id = std::uint32_t;
+
+private:
+  std::vector<std::string_view> m_names = {};
+  std::vector<const Rule *> m_rules = {};
+  std::vector<bool> m_leaves = {};
+  std::vector<std::uint32_t> m_offsets = {};
+  std::vector<Id> m_edges = {};
+  std::vector<std::uint32_t> m_dependent_offsets = {};
+  std::vector<Id> m_dependents = {};
+  std::unordered_map<std::string_view, Id> m_ids = {};
+
+  Id intern(std::string_view name);
+
+public:
+  explicit Graph(const std::set<Rule, std::less<>> &rules);
+
+  Graph(const Graph &) = delete;
+  Graph &operator=(const Graph &) = delete;
+
+  [[nodiscard]] std::size_t size() const;
+  [[nodiscard]] Option<Id> find(std::string_view name) const;
+  [[nodiscard]] std::string_view name(Id id) const;
+  [[nodiscard]] bool is_leaf(Id id) const;
+  // `id' must not be a leaf.
+  [[nodiscard]] const Rule &rule(Id id) const;
+  [[nodiscard]] std::span<const Id> prereqs(Id id) const;
+  // The targets that list `id' as a prerequisite.
+  [[nodiscard]] std::span<const Id> dependents(Id id) const;
+};
+
 struct Environment {
-  // During parsing the resolver needs to allocate strings for macro lookup. The
-  // lifetime of these strings is managed by this map. Each rule in the set
-  // below *may* hold a string_view to one of the values in this map.
-  const std::map<std::string_view, std::string> macros;
+  // During parsing the resolver needs to allocate strings for macro values and
+  // expanded actions. Their lifetime is managed by this arena. Each macro and
+  // rule below *may* hold a string_view into it.
+  const Arena strings;
+  const std::map<std::string_view, std::string_view> macros;
   const std::set<Rule, std::less<>> rules;
   std::string_view head;
+  // The directories generic-rule inference looked in, and the names it looked
+  // for there. Rules inferred from them only hold while the same ones exist.
+  const std::vector<Listing> listings = {};
+  // Derived from `rules', so an Environment can't be copied or moved either.
+  const Graph graph = Graph{rules};
 
   const Rule &get(std::string_view) const;
   bool is_leaf(std::string_view) const;
-  bool operator==(const Environment &) const = default;
+  // Compares everything but `graph', which only restates `rules'.
+  bool operator==(const Environment &) const;
+};
+
+// Splits a Fabfile into tokens on demand, so the parser never needs the whole
+// token stream in memory. Once the source runs out next() keeps returning Eof.
+class Lexer {
+  std::string_view m_source;
+  std::size_t m_offset = 0;
+  scan::Classifier m_classes;
+
+public:
+  explicit Lexer(std::string_view source);
+
+  Token next();
+};
+
+// A whole token stream in structure-of-arrays form: a byte per token for its
+// type and 32-bit offsets and lengths into the source for lexemes. That's 9
+// bytes a token rather than sizeof(Token). The source must outlive the
+// stream.
+class TokenStream {
+  std::string_view m_source;
+  std::vector<Token::Ty> m_types = {};
+  std::vector<std::uint32_t> m_offsets = {};
+  std::vector<std::uint32_t> m_lengths = {};
+
+public:
+  // Throws std::runtime_error if `source' is too big to index with 32 bits.
+  explicit TokenStream(std::string_view source);
+
+  [[nodiscard]] std::size_t size() const;
+  [[nodiscard]] Token::Ty ty(std::size_t i) const;
+  [[nodiscard]] Token operator[](std::size_t i) const;
 };
 
 std::vector<Token> lex(std::string_view source);
 Environment parse(std::vector<Token> &&tokens);
+Environment parse(Lexer lexer);
+Environment parse(const TokenStream &tokens);
 
 template <typename T>
 std::ostream &
@@ -0,0 +1,206 @@
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "builddb.h"
+#include "fabcache.h"
+#include "hash.h"
+#include "serial.h"
+#include "statcache.h"
+#include "trace.h"
+
+namespace {
+// Bump the trailing digits whenever the layout changes; a cache with a
+// different header is never a hit.
+constexpr auto MAGIC = std::string_view{"fabenv03"};
+
+// Everything a cache must match before it can stand in for the Fabfile.
+[[nodiscard]] std::string
+header(const std::string &fabfile, std::string_view source) {
+  auto out = std::string{MAGIC};
+  put(out, std::string_view{fabfile});
+  put(out, static_cast<std::uint64_t>(source.size()));
+  put(out, to_ticks(stat_file(fabfile).mtime));
+  put(out, hash_bytes(source));
+  return out;
+}
+
+void
+encode(std::string &out, const Environment &env) {
+  put(out, env.head);
+
+  put(out, static_cast<std::uint32_t>(env.listings.size()));
+  for (const auto &l : env.listings) {
+    put(out, l.dir);
+    put(out, static_cast<std::uint32_t>(l.names.size()));
+    for (auto name : l.names) {
+      put(out, name);
+    }
+    put(out, l.found);
+  }
+
+  put(out, static_cast<std::uint32_t>(env.macros.size()));
+  for (const auto &[name, value] : env.macros) {
+    put(out, name);
+    put(out, value);
+  }
+
+  put(out, static_cast<std::uint32_t>(env.rules.size()));
+  for (const auto &rule : env.rules) {
+    put(out, rule.target);
+
+    put(out, static_cast<std::uint32_t>(rule.prereqs.size()));
+    for (auto p : rule.prereqs) {
+      put(out, p);
+    }
+
+    put(out, static_cast<std::uint32_t>(rule.actions.size()));
+    for (auto a : rule.actions) {
+      put(out, a);
+    }
+  }
+}
+
+// An Environment's members are const, so it's put together from these once
+// the whole cache has been read.
+struct Parts {
+  std::map<std::string_view, std::string_view> macros = {};
+  std::set<Rule, std::less<>> rules = {};
+  std::string_view head = {};
+  std::vector<Listing> listings = {};
+};
+
+// Returns nothing if the cache is truncated, has trailing garbage, or rules
+// were inferred from files that have come or gone since.
+[[nodiscard]] std::optional<Parts>
+decode(Reader in) {
+  auto parts = Parts{.head = in.str()};
+
+  auto dirs = DirCache{};
+  const auto listings = in.get<std::uint32_t>();
+  for (std::uint32_t i = 0; i < listings && in.ok(); ++i) {
+    auto listing = Listing{.dir = in.str(), .names = {}, .found = 0};
+    const auto n = in.get<std::uint32_t>();
+    for (std::uint32_t j = 0; j < n && in.ok(); ++j) {
+      listing.names.push_back(in.str());
+    }
+    listing.found = in.get<std::uint64_t>();
+
+    if (!in.ok() || listing.found != dirs.found(listing.dir, listing.names)) {
+      return std::nullopt;
+    }
+
+    parts.listings.push_back(std::move(listing));
+  }
+
+  // Entries were written in sorted order, so each one goes at the end.
+  const auto macros = in.get<std::uint32_t>();
+  for (std::uint32_t i = 0; i < macros && in.ok(); ++i) {
+    const auto name = in.str();
+    parts.macros.emplace_hint(parts.macros.end(), name, in.str());
+  }
+
+  const auto rules = in.get<std::uint32_t>();
+  for (std::uint32_t i = 0; i < rules && in.ok(); ++i) {
+    const auto target = in.str();
+
+    auto prereqs = std::vector<std::string_view>{};
+    const auto n = in.get<std::uint32_t>();
+    for (std::uint32_t j = 0; j < n && in.ok(); ++j) {
+      prereqs.push_back(in.str());
+    }
+
+    auto actions = std::vector<std::string_view>{};
+    const auto m = in.get<std::uint32_t>();
+    for (std::uint32_t j = 0; j < m && in.ok(); ++j) {
+      actions.push_back(in.str());
+    }
+
+    parts.rules.emplace_hint(parts.rules.end(), target, std::move(prereqs),
+                             std::move(actions));
+  }
+
+  if (!in.ok() || !in.empty()) {
+    return std::nullopt;
+  }
+
+  return parts;
+}
+
+// Writes the cache beside its final location and renames it into place, so a
+// concurrent fab never maps half a cache.
+void
+save(const std::string &path, std::string_view image) {
+  const auto tmp = path + ".tmp";
+  const auto fd =
+      open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (-1 == fd) {
+    return;
+  }
+
+  const auto ok = write_all(fd, image);
+  close(fd);
+
+  if (!ok || 0 != rename(tmp.c_str(), path.c_str())) {
+    unlink(tmp.c_str());
+  }
+}
+} // namespace
+
+FabCache::FabCache(std::string path)
+    : m_path(std::move(path)) {
+  try {
+    m_image.emplace(m_path);
+  } catch (const std::runtime_error &) {
+    // No cache yet.
+  }
+}
+
+Environment
+FabCache::load(const std::string &fabfile, std::string_view source) {
+  m_hit = false;
+  m_key.clear();
+
+  // Pipes don't have a stable identity to key on.
+  if (!std::filesystem::is_regular_file(fabfile)) {
+    return parse(Lexer{source});
+  }
+
+  auto key = header(fabfile, source);
+  if (m_image && m_image->text().starts_with(key)) {
+    const auto span = trace::Span{"phase", "decode fabfile cache"};
+    if (auto parts = decode(Reader{m_image->text().substr(key.size())})) {
+      m_hit = true;
+      return Environment{.macros = std::move(parts->macros),
+                         .rules = std::move(parts->rules),
+                         .head = parts->head,
+                         .listings = std::move(parts->listings)};
+    }
+  }
+
+  m_key = std::move(key);
+  return parse(Lexer{source});
+}
+
+void
+FabCache::store(const Environment &env) {
+  if (m_key.empty()) {
+    return;
+  }
+
+  encode(m_key, env);
+  save(m_path, m_key);
+  m_key.clear();
+}
+
+bool
+FabCache::hit() const {
+  return m_hit;
+}
@@ -0,0 +1,44 @@
+#ifndef FABCACHE_H
+#define FABCACHE_H
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "fab.h"
+#include "source.h"
+
+// A compiled copy of the last Environment fab parsed. It's reused as long as
+// the Fabfile has the same path, size, mtime and contents; otherwise the
+// Fabfile is parsed again and store() rewrites the cache.
+//
+// The cache is mapped into memory and a loaded Environment's views point into
+// the mapping, so a FabCache must outlive the Environments it returns.
+class FabCache {
+  const std::string m_path;
+  std::optional<Source> m_image = {};
+  bool m_hit = false;
+  // The header of a cache for what the last load() parsed, if it's worth
+  // storing.
+  std::string m_key = {};
+
+public:
+  explicit FabCache(std::string path);
+
+  FabCache(const FabCache &) = delete;
+  FabCache &operator=(const FabCache &) = delete;
+
+  // Returns the Environment for the Fabfile at `fabfile', whose text is
+  // `source'.
+  [[nodiscard]] Environment load(const std::string &fabfile,
+                                 std::string_view source);
+
+  // Saves `env' as the compiled form of the Fabfile the last load() had to
+  // parse. Does nothing if load() didn't parse.
+  void store(const Environment &env);
+
+  // Whether the last load() came from the cache.
+  [[nodiscard]] bool hit() const;
+};
+
+#endif // FABCACHE_H
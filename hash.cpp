@@ -0,0 +1,89 @@
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hash.h"
+
+namespace {
+constexpr std::uint64_t K0 = 0x9e3779b97f4a7c15ULL;
+constexpr std::uint64_t K1 = 0xbf58476d1ce4e5b9ULL;
+constexpr std::uint64_t K2 = 0x94d049bb133111ebULL;
+
+[[nodiscard]] constexpr std::uint64_t
+rotl(std::uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// splitmix64's finalizer: every input bit affects every output bit.
+[[nodiscard]] constexpr std::uint64_t
+avalanche(std::uint64_t x) {
+  x = (x ^ (x >> 30)) * K1;
+  x = (x ^ (x >> 27)) * K2;
+  return x ^ (x >> 31);
+}
+} // namespace
+
+std::uint64_t
+hash_bytes(std::string_view bytes) {
+  auto h = K0 ^ (bytes.size() * K1);
+  const auto *p = bytes.data();
+  auto n = bytes.size();
+
+  for (; n >= sizeof(std::uint64_t); n -= sizeof(std::uint64_t)) {
+    auto w = std::uint64_t{};
+    std::memcpy(&w, p, sizeof(w));
+    p += sizeof(w);
+    h = rotl(h ^ (rotl(w * K1, 31) * K2), 27) * K0;
+  }
+
+  auto tail = std::uint64_t{};
+  if (0 < n) {
+    std::memcpy(&tail, p, n);
+  }
+  h ^= rotl(tail * K1, 31) * K2;
+
+  const auto out = avalanche(h);
+  return NO_HASH == out ? 1 : out;
+}
+
+std::uint64_t
+hash_combine(std::uint64_t seed, std::uint64_t h) {
+  return avalanche(rotl(seed, 27) * K0 ^ h);
+}
+
+std::uint64_t
+hash_file(std::string_view path) {
+  const auto p = std::string{path.cbegin(), path.cend()};
+  const auto fd = open(p.c_str(), O_RDONLY | O_CLOEXEC);
+
+  if (-1 == fd) {
+    return NO_HASH;
+  }
+
+  struct stat st = {};
+  if (-1 == fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return NO_HASH;
+  }
+
+  const auto size = static_cast<std::size_t>(st.st_size);
+  if (0 == size) {
+    close(fd);
+    return hash_bytes({});
+  }
+
+  auto *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (MAP_FAILED == addr) {
+    return NO_HASH;
+  }
+
+  const auto h = hash_bytes({static_cast<const char *>(addr), size});
+  munmap(addr, size);
+  return h;
+}
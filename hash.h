@@ -0,0 +1,21 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstdint>
+#include <string_view>
+
+// A fast, non-cryptographic 64-bit hash. It's only used to notice that
+// content changed between runs, never to resist deliberate collisions.
+std::uint64_t hash_bytes(std::string_view bytes);
+
+// Mixes `h' into `seed'. The result depends on the order of the calls.
+std::uint64_t hash_combine(std::uint64_t seed, std::uint64_t h);
+
+// Hashes the contents of the regular file at `path'. Returns NO_HASH when the
+// path isn't a regular file or can't be read.
+std::uint64_t hash_file(std::string_view path);
+
+// hash_bytes() never returns this value.
+constexpr std::uint64_t NO_HASH = 0;
+
+#endif // HASH_H
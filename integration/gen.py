@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""Generates Fabfiles of a given shape and size for scaling tests.
+
+usage: gen.py SHAPE N > Fabfile
+
+Every shape has roughly N rules, and its first rule builds everything.
+"""
+import sys
+
+
+def chain(n):
+    """A single path N rules deep."""
+    yield 'all <- r_0;'
+    for i in range(n - 1):
+        yield f'r_{i} <- r_{i + 1} {{ touch $@; }}'
+    yield f'r_{n - 1} <- src.c {{ touch $@; }}'
+
+
+def fanout(n):
+    """One rule over N independent leaves' rules."""
+    yield 'all <- ' + ' '.join(f'o_{i}.o' for i in range(n)) + ';'
+    for i in range(n):
+        yield f'o_{i}.o <- s_{i}.c {{ cc -c -o $@ $<; }}'
+
+
+def diamond(n, width=100):
+    """Layers of WIDTH rules where each rule depends on two in the next
+    layer, so most paths through the graph share most of their rules."""
+    layers = max(1, n // width)
+    yield 'all <- ' + ' '.join(f'd_0_{j}' for j in range(width)) + ';'
+    for i in range(layers):
+        for j in range(width):
+            if i + 1 < layers:
+                a, b = j, (j + 1) % width
+                yield f'd_{i}_{j} <- d_{i + 1}_{a} d_{i + 1}_{b} {{ touch $@; }}'
+            else:
+                yield f'd_{i}_{j} <- leaf_{j}.c {{ touch $@; }}'
+
+
+def macros(n):
+    """N macros, each built on another, used by one rule apiece. Each refers
+    to the one at half its index, so values stay logarithmically long."""
+    yield 'm_0 := -DBASE;'
+    for i in range(1, n):
+        yield f'm_{i} := -DM{i} $(m_{(i - 1) // 2});'
+    yield 'all <- ' + ' '.join(f'r_{i}' for i in range(n)) + ';'
+    for i in range(n):
+        yield f'r_{i} {{ echo $(m_{i}); }}'
+
+
+def fills(n):
+    """N objects built from one generic rule through explicit fills."""
+    yield '[*.o] <- [*.c] { cc -c -o $@ $<; }'
+    yield 'all <- ' + ' '.join(f'f_{i}.o' for i in range(n)) + ';'
+    for i in range(n):
+        yield f'[f_{i}.o] <- [f_{i}.c];'
+
+
+SHAPES = {
+    'chain': chain,
+    'fanout': fanout,
+    'diamond': diamond,
+    'macros': macros,
+    'fills': fills,
+}
+
+
+def generate(shape, n):
+    return '\n'.join(SHAPES[shape](n)) + '\n'
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3 or sys.argv[1] not in SHAPES:
+        sys.exit(f'usage: gen.py {{{"|".join(SHAPES)}}} N')
+
+    sys.stdout.write(generate(sys.argv[1], int(sys.argv[2])))
@@ -1,5 +1,9 @@
 #!/usr/bin/env python3
+import contextlib
+import os
 import subprocess
+import tempfile
+import time
 
 COL = 78
 
@@ -10,9 +14,10 @@ def report(name, status):
 
 
 class Manifest:
-    def __init__(self, name, fd):
+    def __init__(self, name, fd, flags=''):
         self.fd = fd
         self.name = name
+        self.flags = flags.split()
         with open(f'output/{name}.{fd}') as exp:
             self.expected = ''.join(exp.readlines()).rstrip()
 
@@ -24,7 +29,8 @@ class Manifest:
 
 
 def run(mft):
-    handle = subprocess.run(f'../fab -f fabfiles/{mft.name}.fab'.split(),
+    handle = subprocess.run(f'../fab -f fabfiles/{mft.name}.fab'.split() +
+                            mft.flags,
                             capture_output=True)
 
     if mft.is_stdout():
@@ -34,8 +40,8 @@ def run(mft):
         return handle.stderr.decode().rstrip()
 
 
-def check(name, fd):
-    mft = Manifest(name, fd)
+def check(name, fd, flags=''):
+    mft = Manifest(name, fd, flags)
     actual = run(mft)
 
     if actual == mft.expected:
@@ -46,6 +52,106 @@ def check(name, fd):
         return 0
 
 
+FAB = os.path.abspath('../fab')
+
+
+@contextlib.contextmanager
+def server(fabfile):
+    """Starts `fab --server' in a fresh directory holding `fabfile', and
+    yields the directory and the server."""
+    with tempfile.TemporaryDirectory() as cwd:
+        with open(os.path.join(cwd, 'Fabfile'), 'w') as f:
+            f.write(fabfile)
+
+        proc = subprocess.Popen([FAB, '--server'], cwd=cwd,
+                                stderr=subprocess.DEVNULL)
+        try:
+            while not os.path.exists(os.path.join(cwd, '.fab.sock')):
+                time.sleep(0.01)
+            yield cwd, proc
+        finally:
+            proc.kill()
+            proc.wait()
+
+
+def served(name, fabfile, between, fd, expected, env=None, args=()):
+    """Builds `fabfile' through a server, calls `between' in its directory,
+    builds again with `env' added to the environment, and compares what the
+    last build printed to `fd'. Every build is passed `args'. A server that
+    died along the way fails the test, even though the client carries on
+    without it."""
+    with server(fabfile) as (cwd, proc):
+        # The second build finds everything up to date, and caches it so.
+        for _ in range(2):
+            subprocess.run([FAB, *args], cwd=cwd, capture_output=True)
+        between(cwd)
+        handle = subprocess.run([FAB, *args], cwd=cwd, capture_output=True,
+                                env=dict(os.environ, **(env or {})))
+        alive = proc.poll() is None
+
+    actual = handle.stdout if 'stdout' == fd else handle.stderr
+    if alive and actual.decode().rstrip() == expected:
+        report(name, 'ok')
+        return 1
+    else:
+        report(name, 'fail')
+        return 0
+
+
+def watched(name, fabfile, between, made):
+    """Runs `fab --watch' on `fabfile', calls `between' in its directory once
+    the first build has made `ready', and waits for `made' to appear."""
+    with tempfile.TemporaryDirectory() as cwd:
+        with open(os.path.join(cwd, 'Fabfile'), 'w') as f:
+            f.write(fabfile)
+
+        proc = subprocess.Popen([FAB, '--watch'], cwd=cwd,
+                                stdout=subprocess.DEVNULL,
+                                stderr=subprocess.DEVNULL)
+        try:
+            while not os.path.exists(os.path.join(cwd, 'ready')):
+                time.sleep(0.01)
+            between(cwd)
+
+            deadline = time.monotonic() + 5
+            while (not os.path.exists(os.path.join(cwd, made)) and
+                   time.monotonic() < deadline):
+                time.sleep(0.01)
+            ok = os.path.exists(os.path.join(cwd, made))
+        finally:
+            proc.kill()
+            proc.wait()
+
+    report(name, 'ok' if ok else 'fail')
+    return 1 if ok else 0
+
+
+SERVED = [
+    # Nothing watches `out' until the first build makes it.
+    ('served_deleted_output',
+     'out/x <- src {\n  mkdir -p out;\n  cp src out/x;\n}\n'
+     'src { touch src; }\n',
+     lambda cwd: os.remove(os.path.join(cwd, 'out/x')),
+     'stderr', 'mkdir -p out\ncp src out/x'),
+    # Actions see the client's environment, not the server's.
+    ('served_environment',
+     'show { printenv FAB_TEST_VAR; }\n',
+     lambda cwd: None,
+     'stdout', 'client', {'FAB_TEST_VAR': 'client'}),
+    # There's nothing to infer x.out from until x.in shows up.
+    ('served_inferred_rule',
+     '[*.out] <- [*.in] {\n  echo $@ from $<;\n}\n\nall <- x.out;\n',
+     lambda cwd: open(os.path.join(cwd, 'x.in'), 'w').close(),
+     'stdout', 'x.out from x.in'),
+    # Each request names its own target, which has to outlive it.
+    ('served_explicit_target',
+     '[*.out] <- [*.in] {\n  echo $@ from $<;\n}\n\nall <- x.out;\n'
+     'other {\n  echo other;\n}\n',
+     lambda cwd: None,
+     'stdout', 'other', None, ['other']),
+]
+
+
 if __name__ == '__main__':
     with open('manifest') as mft:
         total = 0
@@ -54,4 +160,16 @@ if __name__ == '__main__':
             total += 1
             passed += check(*line.rstrip().split(','))
 
+        for test in SERVED:
+            total += 1
+            passed += served(*test)
+
+        total += 1
+        passed += watched('watched_inferred_rule',
+                          '[*.out] <- [*.in] {\n  cp $< $@;\n}\n\n'
+                          'all <- ready x.out;\nready { touch ready; }\n',
+                          lambda cwd: open(os.path.join(cwd, 'x.in'),
+                                           'w').close(),
+                          'x.out')
+
         print(f'\n{passed}/{total} tests passed.')
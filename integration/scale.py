@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+"""Runs fab over generated Fabfiles of growing size, and fails if its time or
+peak memory grows faster than linearly in the size of the Fabfile.
+
+usage: scale.py [N...]
+"""
+import math
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+import gen
+
+COL = 78
+FAB = os.path.abspath('../fab')
+SIZES = [12_500, 25_000, 50_000, 100_000]
+REPEAT = 3
+# Costs are fit to c * n^k. Everything fab does should be linear; the slack
+# covers timer noise and caches that stop fitting as inputs grow.
+MAX_EXPONENT = 1.3
+
+
+def report(name, status):
+    dots = '.' * (COL - len(name) - len(status))
+    print(f'{name}{dots}{status}')
+
+
+def measure(fabfile, cwd):
+    """Best wall time in seconds and peak RSS in KiB over REPEAT runs of a dry
+    run, each with no Fabfile cache or build log to lean on."""
+    best_time, best_rss = math.inf, math.inf
+
+    for _ in range(REPEAT):
+        for state in ('.fab_cache', '.fab_db'):
+            if os.path.exists(os.path.join(cwd, state)):
+                os.remove(os.path.join(cwd, state))
+
+        start = time.perf_counter()
+        proc = subprocess.Popen([FAB, '-n', '-f', fabfile], cwd=cwd,
+                                stdout=subprocess.DEVNULL,
+                                stderr=subprocess.DEVNULL)
+        _, status, usage = os.wait4(proc.pid, 0)
+        elapsed = time.perf_counter() - start
+        proc.returncode = os.waitstatus_to_exitcode(status)
+
+        if proc.returncode != 0:
+            raise RuntimeError(f'fab exited with {proc.returncode} on {fabfile}')
+
+        best_time = min(best_time, elapsed)
+        best_rss = min(best_rss, usage.ru_maxrss)
+
+    return best_time, best_rss
+
+
+def exponent(xs, ys):
+    """The least-squares slope of log(ys) against log(xs)."""
+    lx = [math.log(x) for x in xs]
+    ly = [math.log(y) for y in ys]
+    mx, my = sum(lx) / len(lx), sum(ly) / len(ly)
+    num = sum((x - mx) * (y - my) for x, y in zip(lx, ly))
+    den = sum((x - mx) ** 2 for x in lx)
+    return num / den
+
+
+def check(shape, sizes, cwd):
+    times, rsss = [], []
+    for n in sizes:
+        fabfile = os.path.join(cwd, f'{shape}_{n}.fab')
+        with open(fabfile, 'w') as out:
+            out.write(gen.generate(shape, n))
+
+        t, rss = measure(fabfile, cwd)
+        times.append(t)
+        rsss.append(rss)
+        print(f'  {shape:<8} n={n:<9} {t * 1000:10.1f}ms {rss / 1024:8.1f}MiB')
+
+    kt, km = exponent(sizes, times), exponent(sizes, rsss)
+    ok = kt <= MAX_EXPONENT and km <= MAX_EXPONENT
+    report(shape, f'time n^{kt:.2f}, rss n^{km:.2f} {"ok" if ok else "fail"}')
+    return ok
+
+
+if __name__ == '__main__':
+    sizes = [int(n) for n in sys.argv[1:]] or SIZES
+
+    with tempfile.TemporaryDirectory() as cwd:
+        passed = sum(check(shape, sizes, cwd) for shape in gen.SHAPES)
+
+    print(f'\n{passed}/{len(gen.SHAPES)} shapes scaled.')
+    sys.exit(0 if passed == len(gen.SHAPES) else 1)
@@ -1,136 +1,319 @@
 #include <algorithm>
-#include <cassert>
-#include <cstdlib>
+#include <array>
+#include <charconv>
+#include <cstring>
 #include <filesystem>
-#include <fstream>
-#include <functional>
 #include <iostream>
 #include <map>
-#include <ranges>
-#include <set>
-#include <sstream>
-#include <stack>
+#include <memory>
+#include <optional>
+#include <stdexcept>
 #include <string>
 #include <string_view>
-#include <type_traits>
 #include <utility>
+#include <vector>
 
+#include <getopt.h>
 #include <unistd.h>
 
+#include "build.h"
 #include "fab.h"
+#include "fabcache.h"
+#include "server.h"
+#include "source.h"
+#include "trace.h"
+#include "watcher.h"
 
 namespace {
-constexpr int CMD_OK = 0;
-
-std::filesystem::file_time_type
-last_write(std::string_view path) {
-  auto ec = std::error_code{};
-  const auto time =
-      std::filesystem::last_write_time({path.cbegin(), path.cend()}, ec);
-
-  if (!ec) {
-    return time;
-  } else {
-    if (std::filesystem::exists(path)) {
-      const auto target = std::string{path.cbegin(), path.cend()};
-      throw std::runtime_error(
-          target + "exists, but could not determine the last write time.");
+// Kept in the working directory, since that's what target paths are relative
+// to.
+constexpr auto BUILD_LOG = ".fab_db";
+constexpr auto FAB_CACHE = ".fab_cache";
+constexpr auto SERVER_SOCKET = ".fab.sock";
+
+constexpr auto USAGE = "usuage: fab [-f <Fabfile>] [-j <jobs>] [-n] "
+                       "[--one-shell] [--stats] [--critical-path] "
+                       "[--trace <file>] [--output-log <file>] [--watch] "
+                       "[--server] target";
+
+struct [[nodiscard]] Args {
+  std::string fabfile = "Fabfile";
+  BuildOptions options = {};
+  // Points into argv.
+  const char *target = nullptr;
+  // Where to write a trace of the build, if anywhere.
+  std::string trace = {};
+  bool watch = false;
+  bool serve = false;
+};
+
+// Throws std::runtime_error if the command line is malformed. Safe to call
+// more than once in a process.
+[[nodiscard]] Args
+parse_args(int argc, char **argv) {
+  auto args = Args{};
+  enum : int {
+    ONE_SHELL = 256,
+    STATS,
+    CRITICAL_PATH,
+    TRACE,
+    OUTPUT_LOG,
+    WATCH,
+    SERVER
+  };
+  const auto longopts = std::array{
+      option{"one-shell", no_argument, nullptr, ONE_SHELL},
+      option{"stats", no_argument, nullptr, STATS},
+      option{"critical-path", no_argument, nullptr, CRITICAL_PATH},
+      option{"trace", required_argument, nullptr, TRACE},
+      option{"output-log", required_argument, nullptr, OUTPUT_LOG},
+      option{"watch", no_argument, nullptr, WATCH},
+      option{"server", no_argument, nullptr, SERVER},
+      option{nullptr, 0, nullptr, 0},
+  };
+
+  // Zero rather than one makes getopt start over completely.
+  optind = 0;
+
+  auto ch = int{};
+  while ((ch = getopt_long(argc, argv, "f:j:n", longopts.data(), nullptr)) !=
+         -1) {
+    switch (ch) {
+    case 'f':
+      args.fabfile = optarg;
+      break;
+    case 'j': {
+      const auto *end = optarg + std::strlen(optarg);
+      const auto [ptr, ec] = std::from_chars(optarg, end, args.options.jobs);
+      if (std::errc{} != ec || end != ptr || 0 == args.options.jobs) {
+        throw std::runtime_error("-j expects a positive number of jobs.");
+      }
+      break;
     }
+    case 'n':
+      args.options.dry_run = true;
+      break;
+    case ONE_SHELL:
+      args.options.one_shell = true;
+      break;
+    case STATS:
+      args.options.stats = true;
+      break;
+    case CRITICAL_PATH:
+      args.options.critical_path = true;
+      break;
+    case TRACE:
+      args.trace = optarg;
+      break;
+    case OUTPUT_LOG:
+      args.options.output_log = optarg;
+      break;
+    case WATCH:
+      args.watch = true;
+      break;
+    case SERVER:
+      args.serve = true;
+      break;
+    case '?':
+    default:
+      throw std::runtime_error(USAGE);
+    }
+  }
+
+  if (optind < argc) {
+    args.target = argv[optind];
+  }
 
-    // If -- for some other reason -- we couldn't open the file, then assume it
-    // doesn't exist and report that the last write time was really long ago.
-    // This allows for gmake `.PHONY' style targets.
-    return std::filesystem::file_time_type::min();
+  if (!args.trace.empty() && (args.watch || args.serve)) {
+    throw std::runtime_error("--trace only traces a single build.");
   }
+
+  return args;
 }
 
-namespace detail {
-void
-run_system_cmds(const std::vector<std::string> &cmds) {
-  for (const auto &cmd : cmds) {
-    std::cerr << cmd << std::endl;
-    if (CMD_OK != system(cmd.c_str())) {
-      throw std::runtime_error("could not run command: " + cmd);
-    }
+// Whether `changed' leaves `env' out of date: either the Fabfile changed, or
+// a file generic-rule inference looked for has come or gone.
+[[nodiscard]] bool
+outdated(const std::string &fabfile, const Environment &env,
+         const std::vector<std::string_view> &changed) {
+  if (std::ranges::find(changed, fabfile) != changed.end()) {
+    return true;
   }
+
+  // Writing fab's own logs changes the working directory too, so most of the
+  // time nothing inference cares about has.
+  auto dirs = DirCache{};
+  return std::ranges::any_of(env.listings, [&](const Listing &l) {
+    return std::ranges::find(changed, l.dir) != changed.end() &&
+           l.found != dirs.found(l.dir, l.names);
+  });
 }
 
-void
-eval(const Rule &rule) {
-  if (rule.is_phony()) {
-    return;
+// The directories generic-rule inference listed for `env'.
+[[nodiscard]] std::vector<std::string_view>
+listed(const Environment &env) {
+  auto dirs = std::vector<std::string_view>{};
+  for (const auto &l : env.listings) {
+    dirs.push_back(l.dir);
   }
 
-  // `target' doesn't exist -- it must be out of date!
-  if (!std::filesystem::exists(rule.target)) {
-    run_system_cmds(rule.actions);
-    return;
+  return dirs;
+}
+
+// Builds `target' -- or the Fabfile's first rule -- and then keeps the
+// Environment and the stat cache around to rebuild it each time one of its
+// leaves changes. A change to the Fabfile itself, or to which rules it infers,
+// starts over from scratch. Errors are reported rather than ending the watch.
+[[noreturn]] void
+watch(const char *program, const std::string &fabfile, const char *target,
+      const BuildOptions &options) {
+  const auto report = [program](const std::runtime_error &exn) {
+    std::cerr << program << ": error: " << exn.what() << std::endl;
+  };
+
+  for (;;) {
+    auto paths = std::vector<std::string_view>{fabfile};
+
+    try {
+      const auto source = Source{fabfile};
+      auto compiled = FabCache{FAB_CACHE};
+      auto env = compiled.load(fabfile, source.text());
+      compiled.store(env);
+
+      if (target) {
+        env.head = target;
+      }
+
+      for (Graph::Id id = 0; id < env.graph.size(); ++id) {
+        if (env.graph.is_leaf(id)) {
+          paths.push_back(env.graph.name(id));
+        }
+      }
+
+      // Watching starts before the build so that nothing saved during it is
+      // missed.
+      auto watcher = Watcher{paths, listed(env)};
+      auto cache = StatCache{};
+      auto db = BuildDb{BUILD_LOG};
+
+      try {
+        build(env, env.head, options, cache, &db);
+      } catch (const std::runtime_error &exn) {
+        report(exn);
+      }
+      db.sync();
+
+      for (;;) {
+        const auto changed = watcher.wait();
+        if (outdated(fabfile, env, changed)) {
+          break;
+        }
+
+        try {
+          rebuild(env, env.head, changed, options, cache, &db);
+        } catch (const std::runtime_error &exn) {
+          report(exn);
+        }
+        db.sync();
+      }
+    } catch (const std::runtime_error &exn) {
+      // The Fabfile doesn't parse; there's nothing to do until it's fixed.
+      report(exn);
+      paths.resize(1);
+      static_cast<void>(Watcher{paths}.wait());
+    }
   }
+}
+
+// A Fabfile the server has parsed, kept for every request that names it along
+// with what's known about the files it mentions, and the directories its rules
+// were inferred from. Before each build, whatever changed since the last one
+// is dropped from the stat cache.
+struct [[nodiscard]] Loaded {
+  const std::string fabfile;
+  const Source source{fabfile};
+  FabCache compiled{FAB_CACHE};
+  Environment env = compiled.load(fabfile, source.text());
+  const std::string_view head = env.head;
+  Watcher watcher{watched(fabfile, env), listed(env)};
+  StatCache cache;
+  // What the current request asked for; `env.head' points at it, since the
+  // request's own arguments go away once it's been served.
+  std::string target;
 
-  // `target' exists without any prereqs -- it must be up to date!
-  if (rule.prereqs.empty()) {
-    return;
+  explicit Loaded(std::string path)
+      : fabfile(std::move(path)) {
+    compiled.store(env);
   }
 
-  const auto times = rule.prereqs | std::views::transform(last_write);
-  const auto max = *std::ranges::max_element(times.begin(), times.end());
+  // Every file the rules mention, built or not: anything else may be touching
+  // them between requests.
+  [[nodiscard]] static std::vector<std::string_view>
+  watched(const std::string &fabfile, const Environment &env) {
+    auto paths = std::vector<std::string_view>{fabfile};
+    for (Graph::Id id = 0; id < env.graph.size(); ++id) {
+      paths.push_back(env.graph.name(id));
+    }
 
-  if (last_write(rule.target) < max) {
-    run_system_cmds(rule.actions);
+    return paths;
   }
-}
-} // namespace detail
-
-template <typename T>
-using Ref = std::reference_wrapper<T>;
-
-//   cases
-//   ------------------------------------------
-//   (1) current node is a leaf
-//         - eval node; mark visited; pop
-//   (2) current node has deps
-//         - if all deps are visited
-//             eval node; mark visited; pop
-//         - else
-//             filter unvisited nodes; push
-void
-eval_rule(const Environment &env, const Rule &rule) {
-  auto stack = std::stack<Ref<const Rule>>{};
-  auto visited = std::set<std::string_view>{};
-  const auto utd = [&v = std::as_const(visited), &e = std::as_const(env)](
-                       auto d) { return v.contains(d) || e.is_leaf(d); };
-  const auto not_utd = std::not_fn(utd);
-
-  stack.push(rule);
-
-  while (!stack.empty()) {
-    const auto &top = stack.top().get();
-    const auto &deps = top.prereqs;
-
-    if (visited.contains(top.target)) {
-      stack.pop();
-      continue;
+};
+
+// Builds what each client asks for, one at a time, until killed. Nothing is
+// parsed or stat'ed again unless it has changed since the last request.
+[[noreturn]] void
+serve_builds() {
+  auto loaded = std::map<std::string, std::unique_ptr<Loaded>>{};
+  auto db = BuildDb{BUILD_LOG};
+
+  serve(SERVER_SOCKET, [&](const std::vector<std::string> &request) {
+    auto argv = std::vector<char *>{};
+    for (const auto &arg : request) {
+      argv.push_back(const_cast<char *>(arg.c_str()));
     }
+    argv.push_back(nullptr);
 
-    if (deps.empty()) {
-      assert(!visited.contains(top.target));
-      detail::eval(top);
-      visited.insert(top.target);
-      stack.pop();
-    } else {
-      if (std::ranges::all_of(deps, utd)) {
-        assert(!visited.contains(top.target));
-        detail::eval(top);
-        visited.insert(top.target);
-        stack.pop();
-      } else {
-        for (auto d :
-             deps | std::views::filter(not_utd) | std::views::reverse) {
-          stack.push(env.get(d));
+    auto status = int{0};
+    try {
+      const auto args =
+          parse_args(static_cast<int>(request.size()), argv.data());
+      if (!std::filesystem::exists(args.fabfile)) {
+        throw std::runtime_error("Fabfile not found.");
+      }
+
+      auto &l = loaded[args.fabfile];
+      if (l) {
+        const auto changed = l->watcher.changes();
+        if (outdated(l->fabfile, l->env, changed)) {
+          l.reset();
+        } else {
+          for (auto path : changed) {
+            l->cache.invalidate(path);
+          }
         }
       }
+
+      auto from = "server";
+      if (!l) {
+        l = std::make_unique<Loaded>(args.fabfile);
+        from = l->compiled.hit() ? "hit" : "miss";
+      }
+
+      if (args.options.stats) {
+        std::cerr << "fabfile cache: " << from << "\n";
+      }
+
+      l->target = args.target ? args.target : l->head;
+      l->env.head = l->target;
+      build(l->env, l->env.head, args.options, l->cache, &db);
+    } catch (const std::runtime_error &exn) {
+      std::cerr << request.front() << ": error: " << exn.what() << std::endl;
+      status = 1;
     }
-  }
+
+    db.sync();
+    return status;
+  });
 }
 } // namespace
 
@@ -141,41 +324,56 @@ main(int argc, char **argv) {
     return 1;
   };
 
-  std::string fabfile = "Fabfile";
-  auto ch = int{};
-  while ((ch = getopt(argc, argv, "f:")) != -1) {
-    switch (ch) {
-    case 'f':
-      fabfile = optarg;
-      break;
-    case '?':
-    default:
-      return errout("usuage: fab [-f <Fabfile>] target");
+  try {
+    const auto args = parse_args(argc, argv);
+
+    if (args.serve) {
+      serve_builds();
     }
-  }
 
-  if (!std::filesystem::exists(fabfile)) {
-    return errout("Fabfile not found.");
-  }
+    // A running server already has everything loaded. Traces are only taken
+    // in-process, where every phase can be seen.
+    if (!args.watch && args.trace.empty()) {
+      if (const auto status = forward(
+              SERVER_SOCKET, std::vector<std::string>{argv, argv + argc})) {
+        return *status;
+      }
+    }
 
-  const auto handle = std::ifstream{fabfile};
+    if (!std::filesystem::exists(args.fabfile)) {
+      return errout("Fabfile not found.");
+    }
 
-  if (!handle.is_open()) {
-    return errout("could not open Fabfile.");
-  }
+    if (args.watch) {
+      watch(argv[0], args.fabfile, args.target, args.options);
+    }
 
-  auto buf = std::stringstream{};
-  buf << handle.rdbuf();
-  const auto program = std::string{std::move(buf.str())};
+    auto recorder = std::optional<trace::Recorder>{};
+    if (!args.trace.empty()) {
+      recorder.emplace(args.trace);
+    }
 
-  try {
-    auto env = parse(lex(program));
+    const auto source = [&] {
+      const auto span = trace::Span{"phase", "read"};
+      return Source{args.fabfile};
+    }();
+    auto compiled = FabCache{FAB_CACHE};
+    auto env = compiled.load(args.fabfile, source.text());
+    compiled.store(env);
+
+    if (args.options.stats) {
+      std::cerr << "fabfile cache: " << (compiled.hit() ? "hit" : "miss")
+                << "\n";
+    }
 
-    if (optind < argc) {
-      env.head = argv[optind];
+    if (args.target) {
+      env.head = args.target;
     }
 
-    eval_rule(env, env.get(env.head));
+    auto cache = StatCache{};
+    auto db = BuildDb{BUILD_LOG};
+    const auto span = trace::Span{"phase", "build"};
+    build(env, env.head, args.options, cache, &db);
   } catch (const std::runtime_error &exn) {
     return errout(exn.what());
   }
@@ -0,0 +1,89 @@
+#include <iostream>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include "printer.h"
+
+Printer::Printer(const std::string &log) {
+  if (!log.empty()) {
+    m_log = gzopen(log.c_str(), "wb");
+    if (!m_log) {
+      throw std::runtime_error("could not open " + log +
+                               " to log the build's output.");
+    }
+  }
+
+  m_thread = std::jthread{[this] { run(); }};
+}
+
+Printer::~Printer() {
+  close();
+}
+
+void
+Printer::run() {
+  auto batch = std::deque<Transcript>{};
+
+  for (;;) {
+    {
+      auto lock = std::unique_lock{m_lock};
+      m_ready.wait(lock, [this] { return m_closed || !m_queue.empty(); });
+
+      if (m_queue.empty()) {
+        return;
+      }
+
+      std::swap(batch, m_queue);
+    }
+
+    for (const auto &transcript : batch) {
+      for (const auto &[stream, text] : transcript) {
+        auto &os = Stream::Out == stream ? std::cout : std::cerr;
+        os.write(text.data(), static_cast<std::streamsize>(text.size()));
+
+        if (m_log && !text.empty()) {
+          gzwrite(m_log, text.data(), static_cast<unsigned>(text.size()));
+        }
+      }
+    }
+
+    // Once per batch rather than once per line; only this thread waits on it.
+    std::cout.flush();
+    batch.clear();
+  }
+}
+
+void
+Printer::print(Transcript transcript) {
+  if (transcript.empty()) {
+    return;
+  }
+
+  {
+    const auto lock = std::scoped_lock{m_lock};
+    m_queue.push_back(std::move(transcript));
+  }
+
+  m_ready.notify_one();
+}
+
+void
+Printer::close() {
+  if (!m_thread.joinable()) {
+    return;
+  }
+
+  {
+    const auto lock = std::scoped_lock{m_lock};
+    m_closed = true;
+  }
+
+  m_ready.notify_one();
+  m_thread.join();
+
+  if (m_log) {
+    gzclose(m_log);
+    m_log = nullptr;
+  }
+}
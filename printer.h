@@ -0,0 +1,51 @@
+#ifndef PRINTER_H
+#define PRINTER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct gzFile_s;
+
+// Which of fab's own descriptors a piece of output belongs on.
+enum class Stream { Out, Err };
+
+// Everything one job printed, in the order it printed it.
+using Transcript = std::vector<std::pair<Stream, std::string>>;
+
+// Prints the output of finished jobs from a thread of its own, so that a job
+// never waits on a terminal. Each transcript comes out whole -- never mixed
+// up with another's -- and transcripts come out in the order they're handed
+// over. Given a path, it also writes everything it prints there, compressed
+// with gzip.
+class Printer {
+  std::mutex m_lock = {};
+  std::condition_variable m_ready = {};
+  std::deque<Transcript> m_queue = {};
+  bool m_closed = false;
+  gzFile_s *m_log = nullptr;
+  std::jthread m_thread = {};
+
+  void run();
+
+public:
+  // Throws std::runtime_error if `log' can't be written.
+  explicit Printer(const std::string &log = {});
+  ~Printer();
+
+  Printer(const Printer &) = delete;
+  Printer &operator=(const Printer &) = delete;
+
+  // Queues `transcript' to be printed; never blocks on the printing itself.
+  void print(Transcript transcript);
+
+  // Returns once everything queued so far has been printed and the log, if
+  // any, is complete. Nothing may be printed afterwards.
+  void close();
+};
+
+#endif // PRINTER_H
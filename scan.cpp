@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "scan.h"
+
+namespace {
+// The byte behind each scan::Class, in bit order.
+constexpr auto BYTES = std::array{' ', '\t', '\n', ';', ']', ')'};
+
+using Masks = std::array<std::uint64_t, BYTES.size()>;
+
+void
+scalar(const char *p, Masks &masks) {
+  masks = {};
+  for (std::size_t i = 0; i < 64; ++i) {
+    for (std::size_t k = 0; k < BYTES.size(); ++k) {
+      masks[k] |= std::uint64_t{BYTES[k] == p[i]} << i;
+    }
+  }
+}
+
+#if defined(__x86_64__)
+// SSE2 is part of x86-64, so this needs no runtime check.
+void
+sse2(const char *p, Masks &masks) {
+  __m128i v[4];
+  for (std::size_t j = 0; j < 4; ++j) {
+    v[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * j));
+  }
+
+  for (std::size_t k = 0; k < BYTES.size(); ++k) {
+    const auto b = _mm_set1_epi8(BYTES[k]);
+    auto mask = std::uint64_t{0};
+
+    for (std::size_t j = 0; j < 4; ++j) {
+      const auto bits = static_cast<std::uint16_t>(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(v[j], b)));
+      mask |= std::uint64_t{bits} << (16 * j);
+    }
+
+    masks[k] = mask;
+  }
+}
+
+__attribute__((target("avx2"))) void
+avx2(const char *p, Masks &masks) {
+  const auto lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+  const auto hi =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32));
+
+  for (std::size_t k = 0; k < BYTES.size(); ++k) {
+    const auto b = _mm256_set1_epi8(BYTES[k]);
+    const auto l = static_cast<std::uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, b)));
+    const auto h = static_cast<std::uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, b)));
+    masks[k] = std::uint64_t{h} << 32 | l;
+  }
+}
+#endif
+} // namespace
+
+namespace scan {
+Isa
+best_isa() {
+#if defined(__x86_64__)
+  static const auto isa =
+      __builtin_cpu_supports("avx2") ? Isa::Avx2 : Isa::Sse2;
+  return isa;
+#else
+  return Isa::Scalar;
+#endif
+}
+
+Classifier::Classifier(std::string_view buf, Isa isa)
+    : m_buf(buf)
+    , m_isa(isa) {
+}
+
+std::uint64_t
+Classifier::matches(std::size_t from, unsigned classes) {
+  const auto block = from - from % BLOCK;
+
+  if (block != m_block) {
+    // The last block is copied out and padded with NULs, which aren't in any
+    // class, so the kernels can always read a whole block.
+    auto tail = std::array<char, BLOCK>{};
+    const auto *p = m_buf.data() + block;
+
+    if (m_buf.size() - block < BLOCK) {
+      std::memcpy(tail.data(), p, m_buf.size() - block);
+      p = tail.data();
+    }
+
+    switch (m_isa) {
+#if defined(__x86_64__)
+    case Isa::Avx2:
+      avx2(p, m_masks);
+      break;
+    case Isa::Sse2:
+      sse2(p, m_masks);
+      break;
+#endif
+    default:
+      scalar(p, m_masks);
+      break;
+    }
+
+    m_block = block;
+  }
+
+  auto mask = std::uint64_t{0};
+  for (std::size_t k = 0; k < CLASSES; ++k) {
+    if (0 != (classes & (1u << k))) {
+      mask |= m_masks[k];
+    }
+  }
+
+  return mask >> (from - block);
+}
+
+std::size_t
+Classifier::find(std::size_t from, unsigned classes) {
+  for (; from < m_buf.size(); from += BLOCK - from % BLOCK) {
+    if (const auto mask = matches(from, classes); 0 != mask) {
+      return from + static_cast<std::size_t>(__builtin_ctzll(mask));
+    }
+  }
+
+  return m_buf.size();
+}
+
+std::size_t
+Classifier::skip(std::size_t from, unsigned classes) {
+  for (; from < m_buf.size(); from += BLOCK - from % BLOCK) {
+    // Bits shifted in from past the end of the block read as misses, and so
+    // does the padding after the buffer.
+    const auto valid = ~std::uint64_t{0} >> (from % BLOCK);
+    if (const auto mask = ~matches(from, classes) & valid; 0 != mask) {
+      return std::min(m_buf.size(),
+                      from + static_cast<std::size_t>(__builtin_ctzll(mask)));
+    }
+  }
+
+  return m_buf.size();
+}
+} // namespace scan
@@ -0,0 +1,56 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Bulk byte classification for the lexer.
+namespace scan {
+enum class Isa { Scalar, Sse2, Avx2 };
+
+// The widest instruction set this CPU supports. Decided once per process.
+[[nodiscard]] Isa best_isa();
+
+// The bytes the lexer scans for. Combine them to search for any of several.
+enum Class : unsigned {
+  Space = 1 << 0,
+  Tab = 1 << 1,
+  Newline = 1 << 2,
+  SemiColon = 1 << 3,
+  RBracket = 1 << 4,
+  RParen = 1 << 5,
+};
+
+// Classifies a buffer 64 bytes at a time, keeping one bitmask per class for
+// the block it last looked at. Tokens are short, so most lookups are answered
+// from the masks already computed rather than by scanning again. Every Isa
+// gives the same answers; the vector ones classify 16 or 32 bytes per step.
+class Classifier {
+  static constexpr std::size_t CLASSES = 6;
+  static constexpr std::size_t BLOCK = 64;
+
+  std::string_view m_buf;
+  Isa m_isa;
+  std::size_t m_block = std::string_view::npos;
+  std::array<std::uint64_t, CLASSES> m_masks = {};
+
+  // Returns the bytes of the block at `from' in any of `classes', shifted so
+  // bit 0 is `from'.
+  [[nodiscard]] std::uint64_t matches(std::size_t from, unsigned classes);
+
+public:
+  explicit Classifier(std::string_view buf, Isa isa = best_isa());
+
+  // Returns the offset of the first byte at or after `from' in one of
+  // `classes', or the size of the buffer if there isn't one.
+  [[nodiscard]] std::size_t find(std::size_t from, unsigned classes);
+
+  // Returns the offset of the first byte at or after `from' *not* in one of
+  // `classes', or the size of the buffer if there isn't one.
+  [[nodiscard]] std::size_t skip(std::size_t from, unsigned classes);
+};
+} // namespace scan
+
+#endif // SCAN_H
@@ -0,0 +1,95 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include <unistd.h>
+
+// Helpers for fab's binary files. Everything is written in host byte order;
+// the files never leave the machine that wrote them.
+
+template <typename T>
+inline void
+put(std::string &out, T value) requires std::is_trivially_copyable_v<T> {
+  out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+inline void
+put(std::string &out, std::string_view s) {
+  put(out, static_cast<std::uint32_t>(s.size()));
+  out.append(s);
+}
+
+// Reads fixed-size fields and strings back out of a record. Any read past the
+// end of the buffer marks the reader bad instead of going out of bounds.
+// Strings are views into the buffer.
+class [[nodiscard]] Reader {
+  std::string_view m_buf;
+  bool m_ok = true;
+
+public:
+  explicit Reader(std::string_view buf)
+      : m_buf(buf) {
+  }
+
+  template <typename T>
+  T get() requires std::is_trivially_copyable_v<T> {
+    auto value = T{};
+    if (m_buf.size() < sizeof(T)) {
+      m_ok = false;
+      return value;
+    }
+
+    std::memcpy(&value, m_buf.data(), sizeof(T));
+    m_buf.remove_prefix(sizeof(T));
+    return value;
+  }
+
+  std::string_view bytes(std::size_t n) {
+    if (m_buf.size() < n) {
+      m_ok = false;
+      return {};
+    }
+
+    const auto out = m_buf.substr(0, n);
+    m_buf.remove_prefix(n);
+    return out;
+  }
+
+  std::string_view str() {
+    return bytes(get<std::uint32_t>());
+  }
+
+  [[nodiscard]] bool ok() const {
+    return m_ok;
+  }
+
+  [[nodiscard]] bool empty() const {
+    return m_buf.empty();
+  }
+};
+
+inline bool
+write_all(int fd, std::string_view buf) {
+  while (!buf.empty()) {
+    const auto n = write(fd, buf.data(), buf.size());
+    if (-1 == n && EINTR == errno) {
+      continue;
+    }
+
+    if (-1 == n) {
+      return false;
+    }
+
+    buf.remove_prefix(static_cast<std::size_t>(n));
+  }
+
+  return true;
+}
+
+#endif // SERIAL_H
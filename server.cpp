@@ -0,0 +1,337 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "serial.h"
+#include "server.h"
+
+extern char **environ;
+
+namespace {
+// A request's stdout and stderr travel with its first bytes as SCM_RIGHTS.
+constexpr std::size_t PASSED_FDS = 2;
+
+// Closes a descriptor when it goes out of scope.
+class [[nodiscard]] Fd {
+  int m_fd;
+
+public:
+  explicit Fd(int fd)
+      : m_fd(fd) {
+  }
+
+  ~Fd() {
+    if (-1 != m_fd) {
+      close(m_fd);
+    }
+  }
+
+  Fd(const Fd &) = delete;
+  Fd &operator=(const Fd &) = delete;
+
+  [[nodiscard]] int get() const {
+    return m_fd;
+  }
+};
+
+[[nodiscard]] sockaddr_un
+address(const std::string &path) {
+  auto addr = sockaddr_un{};
+  addr.sun_family = AF_UNIX;
+
+  if (sizeof(addr.sun_path) <= path.size()) {
+    throw std::runtime_error("socket path too long: " + path);
+  }
+
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  return addr;
+}
+
+// Reads from `fd' until `buf' holds at least `n' bytes. Returns false if the
+// other end hangs up first.
+[[nodiscard]] bool
+read_until(int fd, std::string &buf, std::size_t n) {
+  auto chunk = std::array<char, 4096>{};
+
+  while (buf.size() < n) {
+    const auto got = read(fd, chunk.data(), chunk.size());
+    if (-1 == got && EINTR == errno) {
+      continue;
+    }
+
+    if (got <= 0) {
+      return false;
+    }
+
+    buf.append(chunk.data(), static_cast<std::size_t>(got));
+  }
+
+  return true;
+}
+
+struct [[nodiscard]] Request {
+  std::string cwd;
+  std::vector<std::string> args;
+  std::vector<std::string> env;
+  std::array<int, PASSED_FDS> fds;
+};
+
+// Reads a count and then that many strings onto `out'.
+void
+get_strings(Reader &in, std::vector<std::string> &out) {
+  const auto count = in.get<std::uint32_t>();
+  for (std::uint32_t i = 0; i < count && in.ok(); ++i) {
+    out.emplace_back(in.str());
+  }
+}
+
+void
+put_strings(std::string &out, const auto &strings) {
+  put(out, static_cast<std::uint32_t>(std::size(strings)));
+  for (const auto &s : strings) {
+    put(out, std::string_view{s});
+  }
+}
+
+// Reads one request off a fresh connection. Returns nothing if the client
+// sent something else, or hung up.
+[[nodiscard]] std::optional<Request>
+receive(int conn) {
+  auto buf = std::string(4096, '\0');
+  auto iov = iovec{.iov_base = buf.data(), .iov_len = buf.size()};
+  alignas(cmsghdr) auto control =
+      std::array<char, CMSG_SPACE(sizeof(int) * PASSED_FDS)>{};
+
+  auto msg = msghdr{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+
+  auto n = ssize_t{};
+  do {
+    n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+  } while (-1 == n && EINTR == errno);
+
+  if (n <= 0) {
+    return {};
+  }
+  buf.resize(static_cast<std::size_t>(n));
+
+  const auto *cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || SOL_SOCKET != cmsg->cmsg_level ||
+      SCM_RIGHTS != cmsg->cmsg_type) {
+    return {};
+  }
+
+  auto request = Request{.cwd = {}, .args = {}, .env = {}, .fds = {}};
+  const auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+  std::memcpy(request.fds.data(), CMSG_DATA(cmsg),
+              std::min(count, PASSED_FDS) * sizeof(int));
+
+  const auto discard = [&] {
+    for (std::size_t i = 0; i < count && i < PASSED_FDS; ++i) {
+      close(request.fds[i]);
+    }
+    return std::nullopt;
+  };
+
+  if (PASSED_FDS != count || !read_until(conn, buf, sizeof(std::uint32_t))) {
+    return discard();
+  }
+
+  auto head = Reader{buf};
+  const auto size = head.get<std::uint32_t>();
+  if (!read_until(conn, buf, sizeof(std::uint32_t) + size)) {
+    return discard();
+  }
+
+  auto in = Reader{std::string_view{buf}.substr(sizeof(std::uint32_t))};
+  request.cwd = in.str();
+  get_strings(in, request.args);
+  get_strings(in, request.env);
+
+  if (!in.ok() || !in.empty() || request.args.empty()) {
+    return discard();
+  }
+
+  return request;
+}
+
+// Whether `cwd' is the directory the server is running in, and so names
+// every relative path the same way.
+[[nodiscard]] bool
+is_here(const std::string &cwd) {
+  auto ec = std::error_code{};
+  return std::filesystem::equivalent(cwd, ".", ec);
+}
+
+// Runs `handle' with the request's descriptors standing in for stdout and
+// stderr, and its environment standing in for the server's.
+[[nodiscard]] int
+redirected(const Request &request, const RequestHandler &handle) {
+  constexpr auto STREAMS = std::array{STDOUT_FILENO, STDERR_FILENO};
+
+  std::cout.flush();
+  auto saved = std::array<int, PASSED_FDS>{};
+  for (std::size_t i = 0; i < PASSED_FDS; ++i) {
+    saved[i] = fcntl(STREAMS[i], F_DUPFD_CLOEXEC, 3);
+    dup2(request.fds[i], STREAMS[i]);
+    close(request.fds[i]);
+  }
+
+  auto env = std::vector<char *>{};
+  env.reserve(request.env.size() + 1);
+  for (const auto &var : request.env) {
+    env.push_back(const_cast<char *>(var.c_str()));
+  }
+  env.push_back(nullptr);
+
+  auto *const saved_env = environ;
+  environ = env.data();
+  const auto status = handle(request.args);
+  environ = saved_env;
+
+  std::cout.flush();
+  for (std::size_t i = 0; i < PASSED_FDS; ++i) {
+    dup2(saved[i], STREAMS[i]);
+    close(saved[i]);
+  }
+
+  return status;
+}
+} // namespace
+
+void
+serve(const std::string &path, const RequestHandler &handle) {
+  // A client that goes away mid-build shouldn't take the server with it.
+  std::signal(SIGPIPE, SIG_IGN);
+
+  const auto addr = address(path);
+  const auto listener = Fd{socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+  if (-1 == listener.get()) {
+    throw std::system_error(errno, std::generic_category(),
+                            "could not create socket");
+  }
+
+  unlink(path.c_str());
+  if (-1 == bind(listener.get(), reinterpret_cast<const sockaddr *>(&addr),
+                 sizeof(addr)) ||
+      -1 == listen(listener.get(), SOMAXCONN)) {
+    throw std::system_error(errno, std::generic_category(),
+                            "could not listen on " + path);
+  }
+
+  for (;;) {
+    const auto conn = Fd{accept4(listener.get(), nullptr, nullptr,
+                                 SOCK_CLOEXEC)};
+    if (-1 == conn.get()) {
+      if (EINTR == errno || ECONNABORTED == errno) {
+        continue;
+      }
+
+      throw std::system_error(errno, std::generic_category(),
+                              "could not accept connection");
+    }
+
+    const auto request = receive(conn.get());
+    if (!request) {
+      continue;
+    }
+
+    // Paths mean something else to a client elsewhere; it had better build
+    // by itself.
+    auto reply = std::string{};
+    if (is_here(request->cwd)) {
+      put(reply, std::uint8_t{1});
+      put(reply, static_cast<std::int32_t>(redirected(*request, handle)));
+    } else {
+      for (auto fd : request->fds) {
+        close(fd);
+      }
+      put(reply, std::uint8_t{0});
+    }
+    static_cast<void>(write_all(conn.get(), reply));
+  }
+}
+
+std::optional<int>
+forward(const std::string &path, const std::vector<std::string> &args) {
+  const auto addr = address(path);
+  const auto conn = Fd{socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+  if (-1 == conn.get() ||
+      -1 == connect(conn.get(), reinterpret_cast<const sockaddr *>(&addr),
+                    sizeof(addr))) {
+    return {};
+  }
+
+  auto env = std::vector<std::string_view>{};
+  for (auto **var = environ; *var; ++var) {
+    env.emplace_back(*var);
+  }
+
+  auto body = std::string{};
+  put(body, std::string_view{std::filesystem::current_path().string()});
+  put_strings(body, args);
+  put_strings(body, env);
+
+  auto request = std::string{};
+  put(request, static_cast<std::uint32_t>(body.size()));
+  request += body;
+
+  auto iov = iovec{.iov_base = request.data(), .iov_len = request.size()};
+  alignas(cmsghdr) auto control =
+      std::array<char, CMSG_SPACE(sizeof(int) * PASSED_FDS)>{};
+
+  auto msg = msghdr{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+
+  auto *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * PASSED_FDS);
+  constexpr auto FDS = std::array{STDOUT_FILENO, STDERR_FILENO};
+  std::memcpy(CMSG_DATA(cmsg), FDS.data(), sizeof(FDS));
+
+  auto sent = ssize_t{};
+  do {
+    sent = sendmsg(conn.get(), &msg, MSG_NOSIGNAL);
+  } while (-1 == sent && EINTR == errno);
+
+  auto reply = std::string{};
+  if (-1 == sent ||
+      !write_all(conn.get(), std::string_view{request}.substr(
+                                 static_cast<std::size_t>(sent))) ||
+      !read_until(conn.get(), reply, sizeof(std::uint8_t))) {
+    throw std::runtime_error("lost connection to the fab server");
+  }
+
+  if (0 == Reader{reply}.get<std::uint8_t>()) {
+    return {};
+  }
+
+  if (!read_until(conn.get(), reply,
+                  sizeof(std::uint8_t) + sizeof(std::int32_t))) {
+    throw std::runtime_error("lost connection to the fab server");
+  }
+
+  auto in = Reader{reply};
+  static_cast<void>(in.get<std::uint8_t>());
+  return in.get<std::int32_t>();
+}
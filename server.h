@@ -0,0 +1,29 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Runs a client's command line -- everything from argv[0] on -- and returns
+// its exit status.
+using RequestHandler = std::function<int(const std::vector<std::string> &)>;
+
+// Listens on the Unix socket at `path', replacing whatever is there, and hands
+// each request to `handle' in turn. A client passes its stdout and stderr
+// along with its command line, and the server's own are swapped for them
+// while `handle' runs, so anything it -- or a child it starts -- writes goes
+// straight to the client. The client's environment stands in for the server's
+// the same way. A request from a client in another working directory is
+// declined. Only returns by throwing std::system_error.
+[[noreturn]] void serve(const std::string &path, const RequestHandler &handle);
+
+// Sends `args', along with this process's stdout, stderr, environment and
+// working directory, to the server on `path' and waits for the exit status.
+// Returns nothing if no server is listening there, or if it declines. Throws
+// std::runtime_error if the server goes away mid-request.
+[[nodiscard]] std::optional<int> forward(const std::string &path,
+                                         const std::vector<std::string> &args);
+
+#endif // SERVER_H
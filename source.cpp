@@ -0,0 +1,68 @@
+#include <array>
+#include <cerrno>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "source.h"
+
+Source::Source(const std::string &path) {
+  const auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (-1 == fd) {
+    throw std::runtime_error("could not open Fabfile.");
+  }
+
+  struct stat st = {};
+  if (-1 != fstat(fd, &st) && S_ISREG(st.st_mode) && 0 < st.st_size) {
+    const auto size = static_cast<std::size_t>(st.st_size);
+    auto *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (MAP_FAILED != addr) {
+      // The lexer makes a single pass from front to back.
+      madvise(addr, size, MADV_SEQUENTIAL);
+      m_addr = addr;
+      m_size = size;
+      close(fd);
+      return;
+    }
+  }
+
+  auto chunk = std::array<char, 1 << 16>{};
+  while (true) {
+    const auto n = read(fd, chunk.data(), chunk.size());
+    if (-1 == n && EINTR == errno) {
+      continue;
+    }
+
+    if (-1 == n) {
+      close(fd);
+      throw std::runtime_error("could not read Fabfile.");
+    }
+
+    if (0 == n) {
+      break;
+    }
+
+    m_buf.append(chunk.data(), static_cast<std::size_t>(n));
+  }
+
+  close(fd);
+}
+
+Source::~Source() {
+  if (nullptr != m_addr) {
+    munmap(m_addr, m_size);
+  }
+}
+
+std::string_view
+Source::text() const {
+  if (nullptr != m_addr) {
+    return {static_cast<const char *>(m_addr), m_size};
+  }
+
+  return m_buf;
+}
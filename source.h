@@ -0,0 +1,28 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// The text of a Fabfile. Regular files are mapped into memory rather than
+// copied; anything else -- a pipe, a terminal -- is read into a buffer. The
+// tokens and Environment parsed from text() point into it, so a Source must
+// outlive them.
+class Source {
+  void *m_addr = nullptr;
+  std::size_t m_size = 0;
+  std::string m_buf = {};
+
+public:
+  // Throws std::runtime_error if `path' can't be opened or read.
+  explicit Source(const std::string &path);
+  ~Source();
+
+  Source(const Source &) = delete;
+  Source &operator=(const Source &) = delete;
+
+  [[nodiscard]] std::string_view text() const;
+};
+
+#endif // SOURCE_H
@@ -0,0 +1,118 @@
+#include <cerrno>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+#include <sys/stat.h>
+
+#include "statcache.h"
+
+FileMeta
+stat_file(std::string_view path) {
+  const auto p = std::string{path.cbegin(), path.cend()};
+  struct stat st = {};
+
+  if (-1 == stat(p.c_str(), &st)) {
+    if (ENOENT == errno || ENOTDIR == errno) {
+      return FileMeta{};
+    }
+
+    throw std::runtime_error(
+        p + " exists, but could not determine the last write time.");
+  }
+
+  return existing_file(st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+}
+
+FileMeta
+existing_file(std::int64_t sec, std::int64_t nsec) {
+  const auto since_epoch =
+      std::chrono::seconds{sec} + std::chrono::nanoseconds{nsec};
+  const auto mtime = std::chrono::file_clock::from_sys(
+      std::chrono::sys_time<std::chrono::nanoseconds>{since_epoch});
+
+  return FileMeta{
+      .exists = true,
+      .mtime = std::chrono::time_point_cast<
+          std::filesystem::file_time_type::duration>(mtime),
+  };
+}
+
+StatCache::Entry &
+StatCache::entry(std::string_view path) {
+  auto &shard = m_shards[std::hash<std::string_view>{}(path) % SHARDS];
+  const auto lock = std::scoped_lock{shard.lock};
+
+  // Elements of an unordered_map stay put when it rehashes, so the entry can
+  // be used after the shard is unlocked.
+  return shard.entries[path];
+}
+
+FileMeta
+StatCache::get(std::string_view path) {
+  auto &e = entry(path);
+  const auto lock = std::scoped_lock{e.lock};
+
+  if (e.valid) {
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+    e.meta = stat_file(path);
+    e.valid = true;
+  }
+
+  return e.meta;
+}
+
+void
+StatCache::put(std::string_view path, const FileMeta &meta) {
+  auto &e = entry(path);
+  const auto lock = std::scoped_lock{e.lock};
+
+  if (!e.valid) {
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+    e.meta = meta;
+    e.valid = true;
+  }
+}
+
+void
+StatCache::invalidate(std::string_view path) {
+  auto &e = entry(path);
+  const auto lock = std::scoped_lock{e.lock};
+  e.valid = false;
+}
+
+bool
+StatCache::has(std::string_view path) {
+  auto &shard = m_shards[std::hash<std::string_view>{}(path) % SHARDS];
+  auto *e = [&]() -> Entry * {
+    const auto lock = std::scoped_lock{shard.lock};
+    const auto it = shard.entries.find(path);
+    return shard.entries.end() == it ? nullptr : &it->second;
+  }();
+
+  if (!e) {
+    return false;
+  }
+
+  const auto lock = std::scoped_lock{e->lock};
+  return e->valid;
+}
+
+std::uint64_t
+StatCache::hits() const {
+  return m_hits.load();
+}
+
+std::uint64_t
+StatCache::misses() const {
+  return m_misses.load();
+}
+
+std::ostream &
+operator<<(std::ostream &os, const StatCache &cache) {
+  return os << "stat cache: " << cache.hits() << " hits, " << cache.misses()
+            << " misses\n";
+}
@@ -0,0 +1,68 @@
+#ifndef STATCACHE_H
+#define STATCACHE_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <unordered_map>
+
+struct FileMeta {
+  bool exists = false;
+  // Missing files report a last write time from long, long ago. This allows
+  // for gmake `.PHONY' style targets.
+  std::filesystem::file_time_type mtime =
+      std::filesystem::file_time_type::min();
+};
+
+// Stats each path at most once and hands the result to every later lookup.
+// An entry only goes stale when the rule that produces the path runs, so the
+// scheduler calls invalidate() once it has. The cache is shared by every job
+// in a build. It stores the views it's given, so paths must outlive it.
+class StatCache {
+  struct Entry {
+    std::mutex lock = {};
+    bool valid = false;
+    FileMeta meta = {};
+  };
+
+  struct Shard {
+    std::mutex lock = {};
+    std::unordered_map<std::string_view, Entry> entries = {};
+  };
+
+  static constexpr std::size_t SHARDS = 64;
+
+  std::array<Shard, SHARDS> m_shards = {};
+  std::atomic<std::uint64_t> m_hits = 0;
+  std::atomic<std::uint64_t> m_misses = 0;
+
+  Entry &entry(std::string_view path);
+
+public:
+  [[nodiscard]] FileMeta get(std::string_view path);
+  // Hands `meta' to later lookups of `path' as though get() had statted it,
+  // unless the cache already knows better.
+  void put(std::string_view path, const FileMeta &meta);
+  void invalidate(std::string_view path);
+  // Whether get() would answer for `path' without a stat. Counts as neither a
+  // hit nor a miss.
+  [[nodiscard]] bool has(std::string_view path);
+
+  [[nodiscard]] std::uint64_t hits() const;
+  [[nodiscard]] std::uint64_t misses() const;
+};
+
+// Stats `path' without going through a cache.
+FileMeta stat_file(std::string_view path);
+
+// The metadata of a file that exists and was last written `sec' seconds and
+// `nsec' nanoseconds after the epoch.
+[[nodiscard]] FileMeta existing_file(std::int64_t sec, std::int64_t nsec);
+
+std::ostream &operator<<(std::ostream &os, const StatCache &cache);
+
+#endif // STATCACHE_H
@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "statring.h"
+
+namespace {
+// glibc has no wrappers for these; liburing is just a layer over the same.
+[[nodiscard]] int
+setup(unsigned entries, io_uring_params &params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+}
+
+[[nodiscard]] int
+enter(int fd, unsigned submit, unsigned wait) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, wait,
+                                  IORING_ENTER_GETEVENTS, nullptr, 0));
+}
+
+[[nodiscard]] bool
+supports_statx(int fd) {
+  // The probe ends in a flexible array of one entry per opcode.
+  auto buf = std::vector<unsigned char>(sizeof(io_uring_probe) +
+                                        256 * sizeof(io_uring_probe_op));
+  auto *probe = reinterpret_cast<io_uring_probe *>(buf.data());
+
+  if (0 > syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe,
+                  256)) {
+    return false;
+  }
+
+  return IORING_OP_STATX <= probe->last_op &&
+         (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+}
+
+template <typename T>
+[[nodiscard]] T *
+at(void *base, std::uint32_t offset) {
+  return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+}
+
+// The kernel writes the tails of the completion queue and reads the tail of
+// the submission queue from other threads.
+[[nodiscard]] unsigned
+load(unsigned *p) {
+  return std::atomic_ref<unsigned>{*p}.load(std::memory_order_acquire);
+}
+
+void
+store(unsigned *p, unsigned v) {
+  std::atomic_ref<unsigned>{*p}.store(v, std::memory_order_release);
+}
+
+[[noreturn]] void
+fail(const char *what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+} // namespace
+
+StatRing::StatRing(unsigned entries) {
+  auto params = io_uring_params{};
+  m_fd = setup(entries, params);
+  if (-1 == m_fd) {
+    fail("could not set up an io_uring");
+  }
+
+  try {
+    // Every kernel with `statx' on a ring maps both queues at once.
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+        !supports_statx(m_fd)) {
+      errno = ENOSYS;
+      fail("io_uring can't run statx");
+    }
+
+    m_entries = params.sq_entries;
+    m_ring_size =
+        std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                 params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    m_ring = mmap(nullptr, m_ring_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == m_ring) {
+      m_ring = nullptr;
+      fail("could not map an io_uring");
+    }
+
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    auto *sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (MAP_FAILED == sqes) {
+      fail("could not map an io_uring");
+    }
+    m_sqes = static_cast<io_uring_sqe *>(sqes);
+  } catch (...) {
+    release();
+    throw;
+  }
+
+  m_sq_head = at<unsigned>(m_ring, params.sq_off.head);
+  m_sq_tail = at<unsigned>(m_ring, params.sq_off.tail);
+  m_sq_mask = at<unsigned>(m_ring, params.sq_off.ring_mask);
+  m_sq_array = at<unsigned>(m_ring, params.sq_off.array);
+  m_cq_head = at<unsigned>(m_ring, params.cq_off.head);
+  m_cq_tail = at<unsigned>(m_ring, params.cq_off.tail);
+  m_cq_mask = at<unsigned>(m_ring, params.cq_off.ring_mask);
+  m_cqes = at<io_uring_cqe>(m_ring, params.cq_off.cqes);
+}
+
+StatRing::~StatRing() {
+  release();
+}
+
+void
+StatRing::release() {
+  if (m_sqes) {
+    munmap(m_sqes, m_sqes_size);
+  }
+
+  if (m_ring) {
+    munmap(m_ring, m_ring_size);
+  }
+
+  close(m_fd);
+}
+
+std::vector<std::optional<FileMeta>>
+StatRing::stat(const std::vector<std::string_view> &paths) {
+  auto out = std::vector<std::optional<FileMeta>>(paths.size());
+
+  // The kernel reads both until the request completes, so neither may move.
+  auto names = std::vector<std::string>(paths.begin(), paths.end());
+  auto bufs = std::vector<struct statx>(paths.size());
+
+  auto next = std::size_t{0};
+  auto unsubmitted = unsigned{0};
+  auto in_flight = unsigned{0};
+
+  const auto reap = [&] {
+    auto head = *m_cq_head;
+    for (const auto end = load(m_cq_tail); head != end; ++head, --in_flight) {
+      const auto &cqe = m_cqes[head & *m_cq_mask];
+      const auto i = static_cast<std::size_t>(cqe.user_data);
+
+      if (0 == cqe.res) {
+        const auto &mtime = bufs[i].stx_mtime;
+        out[i] = existing_file(mtime.tv_sec, mtime.tv_nsec);
+      } else if (-ENOENT == cqe.res || -ENOTDIR == cqe.res) {
+        out[i] = FileMeta{};
+      }
+    }
+    store(m_cq_head, head);
+  };
+
+  // The kernel may still be writing into `names' and `bufs' for whatever it
+  // has taken, so neither can go away before those complete. What it hasn't
+  // taken is dropped from the queue; nothing here polls it, so only enter()
+  // would. If the wait fails too, the buffers are leaked rather than freed
+  // under the kernel.
+  const auto abandon = [&](const char *what) {
+    const auto error = errno;
+    in_flight -= unsubmitted;
+    store(m_sq_tail, load(m_sq_head));
+
+    for (reap(); 0 < in_flight; reap()) {
+      if (-1 == enter(m_fd, 0, 1) && EINTR != errno) {
+        static_cast<void>(new auto(std::move(names)));
+        static_cast<void>(new auto(std::move(bufs)));
+        break;
+      }
+    }
+
+    errno = error;
+    fail(what);
+  };
+
+  while (next < paths.size() || 0 < in_flight) {
+    // Fill whatever room the ring has. The completion queue is twice as
+    // large, so it can't overflow with no more than this outstanding.
+    auto tail = *m_sq_tail;
+    for (; next < paths.size() && in_flight < m_entries; ++next, ++in_flight) {
+      const auto slot = tail++ & *m_sq_mask;
+      auto &sqe = m_sqes[slot];
+
+      std::memset(&sqe, 0, sizeof(sqe));
+      sqe.opcode = IORING_OP_STATX;
+      sqe.fd = AT_FDCWD;
+      sqe.addr = reinterpret_cast<std::uintptr_t>(names[next].c_str());
+      sqe.len = STATX_MTIME;
+      sqe.off = reinterpret_cast<std::uintptr_t>(&bufs[next]);
+      sqe.user_data = next;
+
+      m_sq_array[slot] = slot;
+      ++unsubmitted;
+    }
+    store(m_sq_tail, tail);
+
+    const auto submitted = enter(m_fd, unsubmitted, 1);
+    if (-1 == submitted) {
+      if (EINTR != errno && EAGAIN != errno && EBUSY != errno) {
+        abandon("could not submit to an io_uring");
+      }
+    } else {
+      unsubmitted -= static_cast<unsigned>(submitted);
+    }
+
+    reap();
+  }
+
+  return out;
+}
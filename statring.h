@@ -0,0 +1,55 @@
+#ifndef STATRING_H
+#define STATRING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "statcache.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// Stats many paths at once through an io_uring(7): `statx' requests go to the
+// kernel in batches as large as the ring, and completions are collected in
+// whatever order they finish. That's a couple of syscalls per batch rather
+// than one per path, and the kernel is free to work on several at a time.
+class StatRing {
+  int m_fd = -1;
+  void *m_ring = nullptr;
+  std::size_t m_ring_size = 0;
+  io_uring_sqe *m_sqes = nullptr;
+  std::size_t m_sqes_size = 0;
+  unsigned m_entries = 0;
+
+  // Where the kernel's shared ring heads, tails and arrays are mapped.
+  unsigned *m_sq_head = nullptr;
+  unsigned *m_sq_tail = nullptr;
+  unsigned *m_sq_mask = nullptr;
+  unsigned *m_sq_array = nullptr;
+  unsigned *m_cq_head = nullptr;
+  unsigned *m_cq_tail = nullptr;
+  unsigned *m_cq_mask = nullptr;
+  io_uring_cqe *m_cqes = nullptr;
+
+  void release();
+
+public:
+  // Throws std::system_error if the kernel has no io_uring, or has one that
+  // can't run `statx', so callers can fall back to stat_file().
+  explicit StatRing(unsigned entries = 256);
+  ~StatRing();
+
+  StatRing(const StatRing &) = delete;
+  StatRing &operator=(const StatRing &) = delete;
+
+  // Returns each path's metadata, in the order given, as stat_file() would
+  // have. Paths the kernel couldn't stat for any reason but their not
+  // existing come back empty, for stat_file() to retry and report.
+  [[nodiscard]] std::vector<std::optional<FileMeta>>
+  stat(const std::vector<std::string_view> &paths);
+};
+
+#endif // STATRING_H
@@ -1,7 +1,36 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <optional>
+#include <system_error>
+#include <thread>
 
+#include <fcntl.h>
 #include <gtest/gtest.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <zlib.h>
 
+#include "build.h"
+#include "builddb.h"
+#include "exec.h"
+#include "executor.h"
+#include "fabcache.h"
+#include "printer.h"
+#include "scan.h"
+#include "server.h"
+#include "source.h"
+#include "statcache.h"
+#include "statring.h"
+#include "trace.h"
+#include "watcher.h"
 #include "fab.h"
 
 TEST(Lexer, ItRecognizesArrows) {
@@ -75,9 +104,65 @@ TEST(Lexer, ItRecognizesGenericRules) {
   ASSERT_EQ(expected, actual);
 }
 
+TEST(Lexer, ItProducesTokensOnDemand) {
+  const auto source = std::string_view{"a <- b { cc $@; } # done\n"};
+  auto lexer = Lexer{source};
+
+  for (const auto &expected : lex(source)) {
+    ASSERT_EQ(expected, lexer.next());
+  }
+
+  ASSERT_EQ(Token::make<Token::Ty::Eof>(), lexer.next());
+  ASSERT_EQ(parse(lex(source)), parse(Lexer{source}));
+}
+
+TEST(Lexer, ItPacksTokensIntoAStream) {
+  const auto source =
+      std::string_view{"CC := cc; a <- b { $(CC) $@ $<; } [*.o] <- [*.c] {}"};
+  const auto expected = lex(source);
+  const auto stream = TokenStream{source};
+
+  ASSERT_EQ(expected.size(), stream.size());
+  for (std::size_t i = 0; i < expected.size(); ++i) {
+    ASSERT_EQ(expected[i].ty(), stream.ty(i));
+    ASSERT_EQ(expected[i], stream[i]);
+  }
+
+  const auto fabfile = std::string_view{"a <- b { cc $<; } b { true; }"};
+  ASSERT_EQ(parse(lex(fabfile)), parse(TokenStream{fabfile}));
+}
+
+TEST(Scan, EveryIsaAgreesWithTheScalarScan) {
+  auto isas = std::vector{scan::Isa::Scalar, scan::best_isa()};
+  if (scan::Isa::Avx2 == scan::best_isa()) {
+    isas.push_back(scan::Isa::Sse2);
+  }
+
+  // Put a single stop at every offset of every length up to a few blocks, and
+  // search from every offset before it.
+  for (std::size_t n = 0; n < 150; n += 7) {
+    for (std::size_t at = 0; at <= n; ++at) {
+      auto s = std::string(n, ' ');
+      if (at < n) {
+        s[at] = ';';
+      }
+
+      for (const auto isa : isas) {
+        auto classes = scan::Classifier{s, isa};
+        for (std::size_t from = 0; from <= at; ++from) {
+          ASSERT_EQ(at, classes.find(from, scan::RParen | scan::SemiColon));
+          ASSERT_EQ(n, classes.find(from, scan::RBracket));
+          ASSERT_EQ(at, classes.skip(from, scan::Space | scan::Tab));
+        }
+      }
+    }
+  }
+}
+
 TEST(Parser, ItParsesARule) {
   auto tokens = lex("main <- main.cpp lib.cpp { c++ -o main main.cpp; }");
-  const auto actual = parse(std::move(tokens)).rules;
+  const auto env = parse(std::move(tokens));
+  const auto &actual = env.rules;
 
   const auto expected =
       std::set<Rule, std::less<>>{{.target = "main",
@@ -89,7 +174,8 @@ TEST(Parser, ItParsesARule) {
 
 TEST(Parser, ItLooksUpMacros) {
   auto tokens = lex("CC := cc; main <- main.c { $(CC) -o main main.c; }");
-  const auto actual = parse(std::move(tokens)).rules;
+  const auto env = parse(std::move(tokens));
+  const auto &actual = env.rules;
 
   const auto expected =
       std::set<Rule, std::less<>>{{.target = "main",
@@ -99,6 +185,16 @@ TEST(Parser, ItLooksUpMacros) {
   ASSERT_EQ(expected, actual);
 }
 
+TEST(Parser, ItOnlyResolvesMacrosThatAreUsed) {
+  auto tokens = lex("B := $(A) b; A := a; X := $(Y); main { echo $(B); }");
+  const auto env = parse(std::move(tokens));
+
+  const auto expected = std::map<std::string_view, std::string_view>{
+      {"A", "a"}, {"B", "a b"}};
+
+  ASSERT_EQ(expected, env.macros);
+}
+
 TEST(Parser, ItExpectsSemicolons) {
   auto tokens = lex("main <- main.cpp { c++ -o main main.cpp }");
   ASSERT_THROW(parse(std::move(tokens)), std::runtime_error);
@@ -112,7 +208,8 @@ TEST(Parser, ItOnlyKnowsDefinedVariables) {
 TEST(Parser, ItCanFillGenericRules) {
   auto tokens = lex("[*.o] <- [*.c] { cc -c $<; } [main.o] <- [main.c]; main "
                     "<- main.o { cc -o $@ $<; }");
-  const auto actual = parse(std::move(tokens)).rules;
+  const auto env = parse(std::move(tokens));
+  const auto &actual = env.rules;
 
   const auto expected = std::set<Rule, std::less<>>{
       {.target = "main.o", .prereqs = {"main.c"}, .actions = {"cc -c main.c"}},
@@ -123,6 +220,682 @@ TEST(Parser, ItCanFillGenericRules) {
   ASSERT_EQ(actual, expected);
 }
 
+TEST(Arena, ItStoresEachStringOnce) {
+  auto arena = Arena{};
+  auto name = std::string{"main.o"};
+  const auto a = arena.intern(name);
+  name[0] = 'x';
+
+  ASSERT_EQ("main.o", a);
+  ASSERT_EQ(a.data(), arena.intern("main.o").data());
+  ASSERT_NE(a.data(), arena.intern("xain.o").data());
+
+  const auto big = arena.intern(std::string(1 << 20, 'b'));
+  const auto moved = std::move(arena);
+  ASSERT_EQ(3, moved.size());
+  ASSERT_EQ(12 + big.size(), moved.bytes());
+  ASSERT_EQ("main.o", a);
+  ASSERT_EQ(std::string(1 << 20, 'b'), big);
+}
+
+TEST(Graph, ItNumbersTargetsBeforeLeaves) {
+  const auto env = parse(lex("a <- b c b { true; } b <- c { true; }"));
+  const auto &g = env.graph;
+
+  ASSERT_EQ(3, g.size());
+  const auto a = g.find("a").value();
+  const auto b = g.find("b").value();
+  const auto c = g.find("c").value();
+
+  ASSERT_FALSE(g.is_leaf(a));
+  ASSERT_FALSE(g.is_leaf(b));
+  ASSERT_TRUE(g.is_leaf(c));
+  ASSERT_EQ("b", g.rule(b).target);
+  ASSERT_EQ("c", g.name(c));
+  ASSERT_TRUE(std::ranges::equal(std::vector{b, c, b}, g.prereqs(a)));
+  ASSERT_TRUE(g.prereqs(c).empty());
+  ASSERT_TRUE(std::ranges::equal(std::vector{a, a}, g.dependents(b)));
+  ASSERT_TRUE(std::ranges::equal(std::vector{a, b}, g.dependents(c)));
+  ASSERT_TRUE(g.dependents(a).empty());
+  ASSERT_FALSE(g.find("d").has_value());
+}
+
+TEST(Exec, ItSplitsSimpleCommands) {
+  const auto actual = split_simple("cc  -c -o main.o\tmain.c -DN=1");
+
+  const auto expected =
+      std::vector<std::string>{"cc", "-c", "-o", "main.o", "main.c", "-DN=1"};
+  ASSERT_EQ(expected, actual);
+}
+
+TEST(Exec, ItLeavesShellSyntaxToTheShell) {
+  for (const auto *cmd :
+       {"printf \"G\"", "echo $(CC)", "cc *.c", "cat a > b", "a && b",
+        "cd build", "CC=gcc make", "echo ~", "umask 022", "ulimit -n 64",
+        "wait", "type cc", "hash -r", "getopts ab x", "while true"}) {
+    ASSERT_EQ(Option<std::vector<std::string>>{}, split_simple(cmd)) << cmd;
+  }
+}
+
+TEST(Exec, ItReportsExitStatus) {
+  ASSERT_EQ(0, run_command("true"));
+  ASSERT_EQ(1, run_command("false"));
+  ASSERT_EQ(3, run_command("exit 3"));
+  ASSERT_EQ(CMD_NOT_FOUND, run_command("fab-no-such-program"));
+}
+
+TEST(Exec, ItRunsScriptsInOneShellUntilALineFails) {
+  ASSERT_EQ((std::vector<int>{0, 0}), run_script({"cd /", "test / = $PWD"}));
+  ASSERT_EQ((std::vector<int>{0, 1}), run_script({"true", "false", "true"}));
+  ASSERT_EQ((std::vector<int>{0, 3}), run_script({"true", "exit 3", "true"}));
+  ASSERT_EQ((std::vector<int>{0, SCRIPT_CUT_SHORT}),
+            run_script({"true", "exit 0", "true"}));
+  ASSERT_EQ((std::vector<int>{0, 0}), run_script({"true", "exit 0"}));
+}
+
+TEST(Exec, ItCapturesWhatCommandsPrintInOrder) {
+  auto output = std::string{};
+  ASSERT_EQ(0, run_command("echo one; echo two >&2; echo three", &output));
+  ASSERT_EQ(CMD_NOT_FOUND, run_command("fab-no-such-program", &output));
+  ASSERT_EQ("one\ntwo\nthree\nfab-no-such-program: command not found\n",
+            output);
+
+  auto outputs = std::vector<std::string>{};
+  const auto cmds = std::vector<std::string_view>{
+      "echo a >&2; echo b", "true", "echo c; false", "echo d"};
+  ASSERT_EQ((std::vector<int>{0, 0, 1}), run_script(cmds, &outputs));
+  ASSERT_EQ((std::vector<std::string>{"a\nb\n", "", "c\n"}), outputs);
+}
+
+TEST(Exec, ItRunsScriptsWithoutAShebangInTheShell) {
+  const auto path =
+      std::filesystem::temp_directory_path() / "fab_test_no_shebang";
+  std::ofstream{path} << "echo one\necho two >&2\n";
+  std::filesystem::permissions(path, std::filesystem::perms::owner_all);
+
+  const auto cmd = path.string() + " ignored";
+  ASSERT_TRUE(split_simple(cmd));
+  auto output = std::string{};
+  ASSERT_EQ(0, run_command(cmd, &output));
+  ASSERT_EQ("one\ntwo\n", output);
+
+  std::filesystem::remove(path);
+}
+
+TEST(Exec, ItKeepsCapturedPipesApartWhereverTheyOpen) {
+  // Fill every descriptor below SCRIPT_STATUS_FD but the last three, so the
+  // output pipe's write end opens on SCRIPT_STATUS_FD itself.
+  auto filled = std::vector<int>{};
+  for (auto fd = 3; fd < SCRIPT_STATUS_FD - 3; ++fd) {
+    if (-1 == fcntl(fd, F_GETFD)) {
+      filled.push_back(dup2(STDIN_FILENO, fd));
+    }
+  }
+  const auto free = std::ranges::all_of(
+      std::array{-3, -2, -1, 0},
+      [](int i) { return -1 == fcntl(SCRIPT_STATUS_FD + i, F_GETFD); });
+
+  auto outputs = std::vector<std::string>{};
+  const auto statuses = free ? run_script({"echo out", "false"}, &outputs)
+                             : std::vector<int>{};
+
+  for (auto fd : filled) {
+    close(fd);
+  }
+
+  if (!free) {
+    GTEST_SKIP() << "descriptors near SCRIPT_STATUS_FD are taken";
+  }
+  ASSERT_EQ((std::vector<int>{0, 1}), statuses);
+  ASSERT_EQ((std::vector<std::string>{"out\n", ""}), outputs);
+}
+
+TEST(Executor, ItRunsTasksSpawnedByTasks) {
+  auto executor = Executor{4};
+  auto count = std::atomic<int>{0};
+
+  for (auto i = 0; i < 64; ++i) {
+    executor.spawn([&] {
+      for (auto j = 0; j < 16; ++j) {
+        executor.spawn([&] { count.fetch_add(1); });
+      }
+    });
+  }
+
+  executor.wait();
+  ASSERT_EQ(64 * 16, count.load());
+
+  auto tasks = std::uint64_t{0};
+  for (const auto &s : executor.stats()) {
+    tasks += s.tasks;
+  }
+  ASSERT_EQ(64 + 64 * 16, tasks);
+}
+
+TEST(Executor, ItRunsTheHighestPriorityTaskFirst) {
+  auto order = std::vector<int>{};
+  auto executor = Executor{1};
+
+  // Spawned from the worker itself, so they're all queued before any runs.
+  executor.spawn([&] {
+    for (auto priority : {1, 3, 2}) {
+      executor.spawn([&order, priority] { order.push_back(priority); },
+                     static_cast<std::uint64_t>(priority));
+    }
+  });
+  executor.wait();
+
+  ASSERT_EQ((std::vector<int>{3, 2, 1}), order);
+}
+
+TEST(Executor, ItRunsTheHighestPriorityTaskOnAnyWorkerFirst) {
+  auto order = std::vector<int>{};
+  auto ran = std::atomic<int>{0};
+  auto queued = std::atomic<bool>{false};
+  auto release = std::atomic<bool>{false};
+  auto executor = Executor{2};
+
+  const auto record = [&](int priority) {
+    return [&, priority] {
+      order.push_back(priority);
+      ran.fetch_add(1);
+    };
+  };
+
+  // The outer task holds one worker while the other picks up the inner one,
+  // which queues an urgent task on its own worker and then blocks. The outer
+  // task then queues more ready tasks than there are workers on its own.
+  executor.spawn([&] {
+    executor.spawn([&] {
+      executor.spawn(record(9), 9);
+      queued = true;
+      release.wait(false);
+    });
+
+    while (!queued) {
+      std::this_thread::yield();
+    }
+
+    for (auto i = 0; i < 5; ++i) {
+      executor.spawn(record(1), 1);
+    }
+  });
+
+  // Only the first worker is free, so it's the only one touching `order'.
+  while (ran < 6) {
+    std::this_thread::yield();
+  }
+  release = true;
+  release.notify_one();
+  executor.wait();
+
+  ASSERT_EQ((std::vector<int>{9, 1, 1, 1, 1, 1}), order);
+}
+
+TEST(StatCache, ItStatsEachPathOnce) {
+  auto cache = StatCache{};
+
+  ASSERT_TRUE(cache.get("testrunner.cpp").exists);
+  ASSERT_TRUE(cache.get("testrunner.cpp").exists);
+  ASSERT_FALSE(cache.get("no-such-file").exists);
+  ASSERT_EQ(1, cache.hits());
+  ASSERT_EQ(2, cache.misses());
+
+  cache.invalidate("testrunner.cpp");
+  ASSERT_TRUE(cache.get("testrunner.cpp").exists);
+  ASSERT_EQ(3, cache.misses());
+}
+
+TEST(StatRing, ItAgreesWithStat) {
+  auto ring = std::optional<StatRing>{};
+  try {
+    ring.emplace(4);
+  } catch (const std::system_error &e) {
+    GTEST_SKIP() << e.what();
+  }
+
+  // More paths than the ring has room for, so it has to go round.
+  auto paths = std::vector<std::string_view>{};
+  for (auto i = 0; i < 5; ++i) {
+    paths.insert(paths.end(), {"testrunner.cpp", "no-such-file", "fab.h/x"});
+  }
+
+  const auto metas = ring->stat(paths);
+  ASSERT_EQ(paths.size(), metas.size());
+  for (std::size_t i = 0; i < paths.size(); ++i) {
+    ASSERT_TRUE(metas[i]);
+    ASSERT_EQ(stat_file(paths[i]).exists, metas[i]->exists);
+    ASSERT_EQ(stat_file(paths[i]).mtime, metas[i]->mtime);
+  }
+}
+
+TEST(BuildDb, ItReadsBackWhatItLogged) {
+  const auto path = std::filesystem::temp_directory_path() / "fab_test_db";
+  std::filesystem::remove(path);
+
+  const auto first =
+      RuleState{.target_mtime = 1,
+                .command = 7,
+                .prereqs = {{.path = "a.c", .mtime = 2, .hash = 3}}};
+  const auto second =
+      RuleState{.target_mtime = 4,
+                .command = 8,
+                .prereqs = {{.path = "a.c", .mtime = 5, .hash = 6}},
+                .duration = 9};
+
+  {
+    auto db = BuildDb{path};
+    db.record("a.o", first);
+    db.record("b.o", first);
+    db.record("a.o", second);
+  }
+
+  auto db = BuildDb{path};
+  ASSERT_EQ(2, db.size());
+  ASSERT_EQ(second, *db.find("a.o"));
+  ASSERT_EQ(first, *db.find("b.o"));
+  ASSERT_EQ(nullptr, db.find("c.o"));
+  std::filesystem::remove(path);
+}
+
+TEST(BuildDb, ItDropsATornRecord) {
+  const auto path = std::filesystem::temp_directory_path() / "fab_test_db";
+  std::filesystem::remove(path);
+
+  {
+    auto db = BuildDb{path};
+    db.record("a.o",
+              RuleState{.target_mtime = 1, .command = 0, .prereqs = {}});
+  }
+
+  {
+    auto log = std::ofstream{path, std::ios::app | std::ios::binary};
+    log << "\x40\x00";
+  }
+
+  {
+    auto db = BuildDb{path};
+    ASSERT_EQ(1, db.size());
+    db.record("b.o",
+              RuleState{.target_mtime = 2, .command = 0, .prereqs = {}});
+  }
+
+  auto db = BuildDb{path};
+  ASSERT_EQ(2, db.size());
+  std::filesystem::remove(path);
+}
+
+TEST(Source, ItReadsFilesAndPipes) {
+  const auto path = std::filesystem::temp_directory_path() / "fab_test_source";
+  std::ofstream{path} << "a { true; }";
+  ASSERT_EQ("a { true; }", Source{path}.text());
+
+  std::ofstream{path, std::ios::trunc};
+  ASSERT_EQ("", Source{path}.text());
+  std::filesystem::remove(path);
+
+  auto fds = std::array<int, 2>{};
+  ASSERT_EQ(0, pipe(fds.data()));
+  ASSERT_EQ(4, write(fds[1], "b {}", 4));
+  close(fds[1]);
+  ASSERT_EQ("b {}", Source{"/dev/fd/" + std::to_string(fds[0])}.text());
+  close(fds[0]);
+}
+
+TEST(FabCache, ItReloadsAnUnchangedFabfile) {
+  const auto dir = std::filesystem::temp_directory_path();
+  const auto fabfile = (dir / "fab_test_fabfile").string();
+  const auto path = dir / "fab_test_fabcache";
+  std::filesystem::remove(path);
+
+  std::ofstream{fabfile} << "CC := cc; a <- b { $(CC) -o $@ $<; } b { true; }";
+  const auto source = Source{fabfile};
+  const auto expected = parse(lex(source.text()));
+
+  {
+    auto cache = FabCache{path};
+    const auto env = cache.load(fabfile, source.text());
+    ASSERT_EQ(expected, env);
+    ASSERT_FALSE(cache.hit());
+    cache.store(env);
+  }
+
+  auto cache = FabCache{path};
+  const auto actual = cache.load(fabfile, source.text());
+  ASSERT_TRUE(cache.hit());
+  ASSERT_EQ(expected, actual);
+  ASSERT_EQ(expected.head, actual.head);
+
+  std::ofstream{fabfile, std::ios::app} << " c { true; }";
+  const auto changed = Source{fabfile};
+  ASSERT_EQ(parse(lex(changed.text())), cache.load(fabfile, changed.text()));
+  ASSERT_FALSE(cache.hit());
+
+  std::filesystem::remove(fabfile);
+  std::filesystem::remove(path);
+}
+
+TEST(FabCache, ItReparsesWhenAnInferredRuleCouldChange) {
+  const auto dir = std::filesystem::temp_directory_path() / "fab_test_infer";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directory(dir);
+
+  const auto fabfile = (dir / "Fabfile").string();
+  const auto obj = (dir / "x.o").string();
+  std::ofstream{fabfile} << "[*.o] <- [*.c] { cc -c $<; } all <- " << obj
+                         << ";";
+  const auto source = Source{fabfile};
+  const auto cache_path = dir / ".fab_cache";
+
+  {
+    auto cache = FabCache{cache_path};
+    const auto env = cache.load(fabfile, source.text());
+    ASSERT_TRUE(env.is_leaf(obj));
+    cache.store(env);
+  }
+
+  // Inference never looked for this one.
+  std::ofstream{dir / ".fab_db"};
+  {
+    auto cache = FabCache{cache_path};
+    static_cast<void>(cache.load(fabfile, source.text()));
+    ASSERT_TRUE(cache.hit());
+  }
+
+  std::ofstream{dir / "x.c"};
+
+  auto cache = FabCache{cache_path};
+  const auto env = cache.load(fabfile, source.text());
+  ASSERT_FALSE(cache.hit());
+  ASSERT_EQ(std::vector<std::string_view>{"cc -c " + (dir / "x.c").string()},
+            env.get(obj).actions);
+
+  std::filesystem::remove_all(dir);
+}
+
+TEST(Build, ItStopsAtTheFirstFailingRule) {
+  const auto env = parse(lex("a <- b c { true; } b { false; } c { true; }"));
+  ASSERT_THROW(build(env, "a", BuildOptions{.jobs = 4}), std::runtime_error);
+}
+
+TEST(Build, ItOnlyRebuildsWhatDependsOnAChange) {
+  const auto env = parse(lex("all <- a b; a <- x { false; } b <- y { true; }"));
+  auto cache = StatCache{};
+
+  ASSERT_NO_THROW(rebuild(env, "all", {"y"}, BuildOptions{}, cache));
+  ASSERT_THROW(rebuild(env, "all", {"x"}, BuildOptions{}, cache),
+               std::runtime_error);
+}
+
+TEST(Build, ItRebuildsWhenTheCommandChanges) {
+  const auto dir = std::filesystem::temp_directory_path() / "fab_test_command";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directory(dir);
+  const auto cwd = std::filesystem::current_path();
+  std::filesystem::current_path(dir);
+
+  const auto runs = [](std::string_view fabfile) {
+    const auto env = parse(lex(fabfile));
+    auto cache = StatCache{};
+    auto db = BuildDb{".fab_db"};
+    build(env, env.head, BuildOptions{}, cache, &db);
+
+    auto log = std::ifstream{"log"};
+    return std::count(std::istreambuf_iterator<char>{log},
+                      std::istreambuf_iterator<char>{}, '\n');
+  };
+
+  const auto before = "out { touch out; echo 1 >> log; }";
+  const auto after = "out { touch out; echo 2 >> log; }";
+  const auto counts = std::array{runs(before), runs(before), runs(after)};
+
+  std::filesystem::current_path(cwd);
+  std::filesystem::remove_all(dir);
+  ASSERT_EQ((std::array<std::ptrdiff_t, 3>{1, 1, 2}), counts);
+}
+
+TEST(Build, ItOnlyRebuildsWhenAPrerequisitesContentChanges) {
+  const auto dir = std::filesystem::temp_directory_path() / "fab_test_content";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directory(dir);
+  const auto cwd = std::filesystem::current_path();
+  std::filesystem::current_path(dir);
+
+  const auto runs = [](std::string_view fabfile) {
+    const auto env = parse(lex(fabfile));
+    auto cache = StatCache{};
+    auto db = BuildDb{".fab_db"};
+    build(env, env.head, BuildOptions{}, cache, &db);
+
+    auto log = std::ifstream{"log"};
+    return std::count(std::istreambuf_iterator<char>{log},
+                      std::istreambuf_iterator<char>{}, '\n');
+  };
+
+  // Saved again with a newer mtime, whether or not anything changed.
+  const auto save = [](std::string_view text) {
+    const auto mtime = std::filesystem::exists("in")
+                           ? std::filesystem::last_write_time("in")
+                           : std::filesystem::file_time_type::clock::now();
+    std::ofstream{"in"} << text;
+    std::filesystem::last_write_time("in", mtime + std::chrono::seconds{1});
+  };
+
+  const auto before = "out <- in { cp in out; echo 1 >> log; }";
+  const auto after = "out <- in { cp in out; echo 2 >> log; }";
+  auto counts = std::array<std::ptrdiff_t, 4>{};
+  save("a");
+  counts[0] = runs(before);
+  save("a");
+  counts[1] = runs(before);
+  save("b");
+  counts[2] = runs(before);
+  counts[3] = runs(after);
+
+  std::filesystem::current_path(cwd);
+  std::filesystem::remove_all(dir);
+  ASSERT_EQ((std::array<std::ptrdiff_t, 4>{1, 1, 2, 3}), counts);
+}
+
+TEST(Build, ItStatsEveryPathBeforeTheWalk) {
+  auto fabfile = std::string{"all <-"};
+  for (auto i = 0; i < 200; ++i) {
+    fabfile += " fab_test_" + std::to_string(i) + ".o";
+  }
+  fabfile += ";";
+  for (auto i = 0; i < 200; ++i) {
+    const auto n = std::to_string(i);
+    fabfile += " fab_test_" + n + ".o <- fab_test_" + n + ".c { true; }";
+  }
+
+  const auto env = parse(lex(fabfile));
+  auto cache = StatCache{};
+
+  testing::internal::CaptureStdout();
+  build(env, "all", BuildOptions{.dry_run = true}, cache);
+  testing::internal::GetCapturedStdout();
+
+  // Every target and source was statted up front; the walk, which only needs
+  // the missing targets, found each of them already there.
+  ASSERT_EQ(400, cache.misses());
+  ASSERT_EQ(200, cache.hits());
+}
+
+TEST(Build, ItOnlyPrefetchesWhatTheCacheLacks) {
+  auto fabfile = std::string{"all <-"};
+  for (auto i = 0; i < 200; ++i) {
+    fabfile += " fab_test_" + std::to_string(i) + ".c";
+  }
+  fabfile += ";";
+
+  const auto env = parse(lex(fabfile));
+  const auto path =
+      (std::filesystem::temp_directory_path() / "fab_test_prefetch.json")
+          .string();
+  const auto prefetched = [&](StatCache &cache) {
+    {
+      auto recorder = trace::Recorder{path};
+      build(env, "all", BuildOptions{}, cache);
+    }
+
+    auto in = std::ifstream{path};
+    const auto json = std::string{std::istreambuf_iterator<char>{in},
+                                  std::istreambuf_iterator<char>{}};
+    return std::string::npos != json.find(R"("name":"prefetch")");
+  };
+
+  auto cache = StatCache{};
+  ASSERT_TRUE(prefetched(cache));
+  ASSERT_FALSE(prefetched(cache));
+  std::filesystem::remove(path);
+}
+
+TEST(Server, ItRunsRequestsInTheClientsOutputAndEnvironment) {
+  const auto socket =
+      (std::filesystem::temp_directory_path() / "fab_test.sock").string();
+
+  const auto pid = fork();
+  if (0 == pid) {
+    try {
+      serve(socket, [](const std::vector<std::string> &args) {
+        const auto *var = std::getenv("FAB_TEST_VAR");
+        std::cout << args.back() << " " << (var ? var : "unset") << std::flush;
+        return 7;
+      });
+    } catch (...) {
+    }
+    _exit(1);
+  }
+
+  setenv("FAB_TEST_VAR", "client", 1);
+  testing::internal::CaptureStdout();
+  auto status = std::optional<int>{};
+  for (auto tries = 0; !status && tries < 1000; ++tries) {
+    status = forward(socket, {"fab", "hello"});
+    usleep(1000);
+  }
+  const auto output = testing::internal::GetCapturedStdout();
+  unsetenv("FAB_TEST_VAR");
+
+  const auto cwd = std::filesystem::current_path();
+  std::filesystem::current_path("/");
+  const auto elsewhere = forward(socket, {"fab", "hello"});
+  std::filesystem::current_path(cwd);
+
+  kill(pid, SIGTERM);
+  waitpid(pid, nullptr, 0);
+  std::filesystem::remove(socket);
+
+  ASSERT_EQ(7, status);
+  ASSERT_EQ("hello client", output);
+  ASSERT_FALSE(elsewhere);
+}
+
+TEST(Printer, ItPrintsAndLogsEachTranscriptWhole) {
+  const auto path =
+      (std::filesystem::temp_directory_path() / "fab_test_output.gz").string();
+
+  testing::internal::CaptureStdout();
+  {
+    auto printer = Printer{path};
+    printer.print({{Stream::Out, "a"}, {Stream::Err, "b"}, {Stream::Out, "c"}});
+    printer.print({{Stream::Out, "d"}});
+  }
+  ASSERT_EQ("acd", testing::internal::GetCapturedStdout());
+
+  auto logged = std::array<char, 16>{};
+  auto *log = gzopen(path.c_str(), "rb");
+  const auto n = gzread(log, logged.data(), logged.size());
+  gzclose(log);
+  std::filesystem::remove(path);
+
+  ASSERT_EQ("abcd",
+            std::string_view(logged.data(), static_cast<std::size_t>(n)));
+}
+
+TEST(Trace, ItRecordsSpansOnlyWhileRecording) {
+  const auto path =
+      (std::filesystem::temp_directory_path() / "fab_test_trace.json").string();
+
+  {
+    const auto ignored = trace::Span{"test", "before"};
+  }
+  {
+    auto recorder = trace::Recorder{path};
+    const auto span = trace::Span{"test", "a \"quoted\" name"};
+  }
+
+  auto in = std::ifstream{path};
+  const auto json = std::string{std::istreambuf_iterator<char>{in},
+                                std::istreambuf_iterator<char>{}};
+  std::filesystem::remove(path);
+
+  ASSERT_EQ(std::string::npos, json.find("before"));
+  ASSERT_NE(std::string::npos, json.find(R"("name":"a \"quoted\" name")"));
+}
+
+TEST(Watcher, ItReportsChangedFiles) {
+  const auto dir = std::filesystem::temp_directory_path() / "fab_test_watch";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directory(dir);
+
+  const auto watched = (dir / "watched").string();
+  const auto ignored = (dir / "ignored").string();
+  std::ofstream{watched};
+
+  auto watcher = Watcher{{watched}};
+  std::ofstream{ignored} << "no";
+  std::ofstream{watched} << "yes";
+  const auto changed = watcher.wait();
+
+  std::filesystem::remove_all(dir);
+  ASSERT_EQ(std::vector<std::string_view>{watched}, changed);
+}
+
+TEST(Watcher, ItKeepsReportingFilesItCantWatch) {
+  const auto dir =
+      std::filesystem::temp_directory_path() / "fab_test_unwatched";
+  std::filesystem::remove_all(dir);
+
+  const auto inside = (dir / "x").string();
+  const auto expected = std::vector<std::string_view>{inside};
+  auto watcher = Watcher{{inside}};
+  ASSERT_EQ(expected, watcher.changes());
+  ASSERT_EQ(expected, watcher.changes());
+
+  std::filesystem::create_directory(dir);
+  std::ofstream{inside};
+  ASSERT_EQ(expected, watcher.changes());
+  ASSERT_TRUE(watcher.changes().empty());
+
+  std::filesystem::remove_all(dir);
+  ASSERT_EQ(expected, watcher.changes());
+  ASSERT_EQ(expected, watcher.changes());
+}
+
+TEST(Watcher, ItReportsDirectoriesWhoseEntriesChange) {
+  const auto dir =
+      std::filesystem::temp_directory_path() / "fab_test_listing";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directory(dir);
+  std::ofstream{dir / "x"};
+
+  const auto listed = dir.string();
+  const auto expected = std::vector<std::string_view>{listed};
+  auto watcher = Watcher{{}, {listed}};
+
+  std::ofstream{dir / "x"} << "rewritten";
+  ASSERT_TRUE(watcher.changes().empty());
+
+  std::ofstream{dir / "y"};
+  ASSERT_EQ(expected, watcher.changes());
+
+  std::filesystem::remove(dir / "x");
+  ASSERT_EQ(expected, watcher.changes());
+
+  std::filesystem::remove_all(dir);
+}
+
 int
 main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
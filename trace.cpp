@@ -0,0 +1,92 @@
+#include <array>
+#include <cstdio>
+#include <fstream>
+#include <utility>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+namespace {
+// Appends `s' as a JSON string.
+void
+put_json(std::string &out, std::string_view s) {
+  out += '"';
+
+  for (auto c : s) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        auto esc = std::array<char, 7>{};
+        std::snprintf(esc.data(), esc.size(), "\\u%04x", c);
+        out += esc.data();
+      } else {
+        out += c;
+      }
+    }
+  }
+
+  out += '"';
+}
+
+[[nodiscard]] long
+thread_id() {
+  thread_local const auto tid = syscall(SYS_gettid);
+  return tid;
+}
+
+[[nodiscard]] long long
+micros(trace::Clock::duration d) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+} // namespace
+
+namespace trace {
+Recorder *active = nullptr;
+
+Recorder::Recorder(std::string path)
+    : m_path(std::move(path)) {
+  active = this;
+}
+
+Recorder::~Recorder() {
+  active = nullptr;
+
+  // A trace that can't be written isn't worth failing the build over.
+  auto out = std::ofstream{m_path};
+  out << "{\"traceEvents\":[" << m_events << "]}\n";
+}
+
+void
+Recorder::complete(std::string_view category, std::string_view name,
+                   Clock::time_point begin, Clock::time_point end) {
+  auto event = std::string{"{\"ph\":\"X\",\"cat\":"};
+  put_json(event, category);
+  event += ",\"name\":";
+  put_json(event, name);
+  event += ",\"ts\":" + std::to_string(micros(begin - m_start));
+  event += ",\"dur\":" + std::to_string(micros(end - begin));
+  event += ",\"pid\":" + std::to_string(getpid());
+  event += ",\"tid\":" + std::to_string(thread_id()) + "}";
+
+  const auto lock = std::scoped_lock{m_lock};
+  if (!m_events.empty()) {
+    m_events += ",\n";
+  }
+
+  m_events += event;
+}
+} // namespace trace
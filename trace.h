@@ -0,0 +1,66 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// Profiling in Chrome's trace event format, for chrome://tracing or Perfetto.
+// Code marks what it wants timed with a Span; while no Recorder exists a Span
+// costs a load and a branch, and records nothing.
+namespace trace {
+using Clock = std::chrono::steady_clock;
+
+// Collects the events from every thread and writes them to `path' as JSON when
+// it's destroyed. At most one may exist at a time, and it must be created
+// before -- and destroyed after -- any thread that might record to it.
+class Recorder {
+  const std::string m_path;
+  const Clock::time_point m_start = Clock::now();
+  std::mutex m_lock = {};
+  std::string m_events = {};
+
+public:
+  explicit Recorder(std::string path);
+  ~Recorder();
+
+  Recorder(const Recorder &) = delete;
+  Recorder &operator=(const Recorder &) = delete;
+
+  // Records that `name' ran on the calling thread from `begin' to `end'.
+  void complete(std::string_view category, std::string_view name,
+                Clock::time_point begin, Clock::time_point end);
+};
+
+// The Recorder spans go to, or nullptr when tracing is off.
+extern Recorder *active;
+
+// Times the scope it's declared in. `name' must outlive the span.
+class [[nodiscard]] Span {
+  Recorder *const m_recorder = active;
+  const std::string_view m_category;
+  const std::string_view m_name;
+  Clock::time_point m_begin = {};
+
+public:
+  Span(std::string_view category, std::string_view name)
+      : m_category(category)
+      , m_name(name) {
+    if (m_recorder) {
+      m_begin = Clock::now();
+    }
+  }
+
+  ~Span() {
+    if (m_recorder) {
+      m_recorder->complete(m_category, m_name, m_begin, Clock::now());
+    }
+  }
+
+  Span(const Span &) = delete;
+  Span &operator=(const Span &) = delete;
+};
+} // namespace trace
+
+#endif // TRACE_H
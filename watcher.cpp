@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <unordered_set>
+#include <utility>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "watcher.h"
+
+namespace {
+// Everything that can leave a file with new contents or a new mtime -- plus
+// the directory itself moving away, after which its path names something
+// else.
+constexpr auto EVENTS = IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                        IN_MOVED_FROM | IN_MOVED_TO | IN_MOVE_SELF;
+
+// What changes a directory's entries.
+constexpr auto ENTRY_EVENTS =
+    IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+} // namespace
+
+Watcher::Watcher(const std::vector<std::string_view> &paths,
+                 const std::vector<std::string_view> &dirs)
+    : m_fd(inotify_init1(IN_CLOEXEC))
+    , m_paths(paths) {
+  if (-1 == m_fd) {
+    throw std::system_error(errno, std::generic_category(),
+                            "could not start watching files");
+  }
+
+  for (auto path : paths) {
+    if (!add(path)) {
+      m_unwatched.push_back(path);
+    }
+  }
+
+  for (auto dir : dirs) {
+    if (!list(dir)) {
+      m_unlisted.push_back(dir);
+    }
+  }
+  m_paths.insert(m_paths.end(), dirs.begin(), dirs.end());
+}
+
+Watcher::~Watcher() {
+  close(m_fd);
+}
+
+bool
+Watcher::read_events(std::vector<std::string_view> &changed) {
+  alignas(inotify_event) auto buf = std::array<char, 64 * 1024>{};
+  const auto n = read(m_fd, buf.data(), buf.size());
+
+  if (-1 == n) {
+    if (EINTR == errno) {
+      return true;
+    }
+
+    throw std::system_error(errno, std::generic_category(),
+                            "could not read file events");
+  }
+
+  for (auto *p = buf.data(); p < buf.data() + n;) {
+    auto event = inotify_event{};
+    std::memcpy(&event, p, sizeof(event));
+
+    if (event.mask & IN_Q_OVERFLOW) {
+      return false;
+    }
+
+    // The directory was deleted or moved; its files have to be found again.
+    if (event.mask & IN_MOVE_SELF) {
+      inotify_rm_watch(m_fd, event.wd);
+    }
+    if (event.mask & (IN_IGNORED | IN_MOVE_SELF)) {
+      lose(event.wd, changed);
+    }
+
+    if (event.mask & ENTRY_EVENTS) {
+      if (const auto dir = m_dirs.find(event.wd); m_dirs.end() != dir) {
+        changed.push_back(dir->second);
+      }
+    }
+
+    if (0 < event.len) {
+      const auto files = m_files.find(event.wd);
+      if (m_files.end() != files) {
+        const auto file = files->second.find(p + sizeof(event));
+        if (files->second.end() != file) {
+          changed.push_back(file->second);
+        }
+      }
+    }
+
+    p += sizeof(event) + event.len;
+  }
+
+  return true;
+}
+
+bool
+Watcher::add(std::string_view path) {
+  const auto slash = path.rfind('/');
+  const auto dir = std::string_view::npos == slash
+                       ? std::string{"."}
+                       : std::string{path.substr(0, 0 == slash ? 1 : slash)};
+  const auto name = std::string{
+      std::string_view::npos == slash ? path : path.substr(slash + 1)};
+
+  // Adding a directory twice hands back the same descriptor.
+  const auto wd = inotify_add_watch(m_fd, dir.c_str(), EVENTS);
+  if (-1 == wd) {
+    return false;
+  }
+
+  m_files[wd].emplace(name, path);
+  return true;
+}
+
+bool
+Watcher::list(std::string_view dir) {
+  const auto wd = inotify_add_watch(m_fd, std::string{dir}.c_str(), EVENTS);
+  if (-1 == wd) {
+    return false;
+  }
+
+  m_dirs.emplace(wd, dir);
+  return true;
+}
+
+void
+Watcher::lose(int wd, std::vector<std::string_view> &changed) {
+  if (const auto files = m_files.find(wd); m_files.end() != files) {
+    for (const auto &[name, path] : files->second) {
+      m_unwatched.push_back(path);
+      changed.push_back(path);
+    }
+
+    m_files.erase(files);
+  }
+
+  if (const auto dir = m_dirs.find(wd); m_dirs.end() != dir) {
+    m_unlisted.push_back(dir->second);
+    changed.push_back(dir->second);
+    m_dirs.erase(dir);
+  }
+}
+
+void
+Watcher::rewatch(std::vector<std::string_view> &changed) {
+  const auto retry = [&](auto &missing, auto watch) {
+    std::erase_if(missing, [&](auto path) {
+      if (!(this->*watch)(path)) {
+        return false;
+      }
+
+      changed.push_back(path);
+      return true;
+    });
+  };
+
+  retry(m_unwatched, &Watcher::add);
+  retry(m_unlisted, &Watcher::list);
+}
+
+std::vector<std::string_view>
+Watcher::drain(std::vector<std::string_view> changed, bool complete,
+               int timeout) {
+  auto fd = pollfd{.fd = m_fd, .events = POLLIN, .revents = 0};
+  while (complete && 0 < poll(&fd, 1, timeout)) {
+    complete = read_events(changed);
+  }
+
+  if (!complete) {
+    return m_paths;
+  }
+
+  auto seen = std::unordered_set<std::string_view>{};
+  std::erase_if(changed, [&](auto path) { return !seen.insert(path).second; });
+  return changed;
+}
+
+std::vector<std::string_view>
+Watcher::wait(std::chrono::milliseconds settle) {
+  auto changed = std::vector<std::string_view>{};
+  auto complete = bool{true};
+  rewatch(changed);
+
+  // Events in directories that don't concern any watched file wake us up
+  // without changing anything -- unless one made a missing directory -- so
+  // keep going until one does.
+  while (changed.empty() && complete) {
+    complete = read_events(changed);
+    rewatch(changed);
+  }
+
+  return drain(std::move(changed), complete,
+               static_cast<int>(settle.count()));
+}
+
+std::vector<std::string_view>
+Watcher::changes() {
+  auto changed = std::vector<std::string_view>{};
+  rewatch(changed);
+
+  // Nothing reports on these, so they may have changed at any time.
+  changed.insert(changed.end(), m_unwatched.begin(), m_unwatched.end());
+  changed.insert(changed.end(), m_unlisted.begin(), m_unlisted.end());
+  return drain(std::move(changed), true, 0);
+}
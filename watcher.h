@@ -0,0 +1,70 @@
+#ifndef WATCHER_H
+#define WATCHER_H
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Reports changes to a set of files through inotify(7). Each file is watched
+// through its directory, so an editor that saves by writing a new file and
+// renaming it over the old one is still noticed. Directories can be watched
+// for entries coming and going, and are reported by their own path. A file
+// whose directory doesn't exist -- yet, or any more -- can't be watched until
+// it does; it's reported as changed by every call to changes() until then, and
+// once more when watching it starts. The same goes for a directory. It stores
+// the views it's given, so paths must outlive it.
+class Watcher {
+  int m_fd = -1;
+  // Watch descriptor, then file name within that directory.
+  std::unordered_map<int, std::unordered_map<std::string, std::string_view>>
+      m_files = {};
+  // Watch descriptor, then the directory watched for its entries.
+  std::unordered_map<int, std::string_view> m_dirs = {};
+  std::vector<std::string_view> m_paths = {};
+  std::vector<std::string_view> m_unwatched = {};
+  std::vector<std::string_view> m_unlisted = {};
+
+  // Starts watching `path' through its directory. Returns false if the
+  // directory can't be watched.
+  bool add(std::string_view path);
+  // Starts watching the entries of `dir'. Returns false if it can't be
+  // watched.
+  bool list(std::string_view dir);
+  // Moves the files and directory watched through `wd', which is gone, to
+  // `m_unwatched' and `m_unlisted' and reports them in `changed'.
+  void lose(int wd, std::vector<std::string_view> &changed);
+  // Watches whichever unwatched files and directories now can be, reporting
+  // them in `changed'.
+  void rewatch(std::vector<std::string_view> &changed);
+  // Reads the events that are ready into `changed'. Returns false if the
+  // kernel dropped some, in which case anything may have changed.
+  bool read_events(std::vector<std::string_view> &changed);
+  // Adds to `changed' until no event arrives for `timeout' milliseconds, then
+  // returns each changed path once.
+  std::vector<std::string_view> drain(std::vector<std::string_view> changed,
+                                      bool complete, int timeout);
+
+public:
+  // Watches the files in `paths' for changes and the directories in `dirs' for
+  // entries coming and going. Throws std::system_error if inotify isn't
+  // available.
+  explicit Watcher(const std::vector<std::string_view> &paths,
+                   const std::vector<std::string_view> &dirs = {});
+  ~Watcher();
+
+  Watcher(const Watcher &) = delete;
+  Watcher &operator=(const Watcher &) = delete;
+
+  // Blocks until a watched file changes, then waits for things to go quiet
+  // for `settle' so that a burst of saves turns into one report. Returns
+  // each changed path once.
+  [[nodiscard]] std::vector<std::string_view>
+  wait(std::chrono::milliseconds settle = std::chrono::milliseconds{50});
+
+  // Returns whatever has changed since the last call, without blocking.
+  [[nodiscard]] std::vector<std::string_view> changes();
+};
+
+#endif // WATCHER_H